@@ -0,0 +1,101 @@
+/* Times concurrent bookers going through the scheduler, as sessions do:
+ * each thread makes single-slot bookings, half of them in slots every
+ * other thread also wants and half in slots of its own.  Afterwards every
+ * slot must be booked exactly once.
+ * usage: bookers backend db [threads] [bookings]
+ * The database needs rooms 1 and 2; see bench/bookers.sh. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+
+static size_t threads = 32;
+static size_t bookings = 200;
+static size_t *made;
+
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Room 1 holds the slots everyone wants, each thread takes them in a
+ * different order; room 2 holds each thread's own */
+static void *booker(void *arg)
+{
+  size_t t = (size_t)arg;
+  reservation_t r;
+  user_t user;
+  size_t i, slot;
+
+  user.id = t + 1;
+  user.status = 0;
+  user.email[0] = '\0';
+  for (i = 0; i < bookings; i++) {
+    r.next = NULL;
+    r.user_id = user.id;
+    if (i % 2 == 0) {
+      slot = (i / 2 + t * 7) % (bookings / 2);
+      r.room_id = 1;
+    } else {
+      slot = t * bookings + i;
+      r.room_id = 2;
+    }
+    r.start = 2000000000 + slot * 3600;
+    r.end = r.start + 1800;
+    if (sched_reserve(r, user) > 0)
+      made[t]++;
+  }
+  return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+  pthread_t *tids;
+  size_t expected, total, i;
+  double started, took;
+
+  if (argc < 3 || 0 != sched_backend(argv[1])) {
+    fprintf(stderr, "usage: %s backend db [threads] [bookings]\n", argv[0]);
+    return 1;
+  }
+  if (argc > 3)
+    threads = strtoul(argv[3], NULL, 10);
+  if (argc > 4)
+    bookings = strtoul(argv[4], NULL, 10);
+  if (threads == 0 || bookings < 2 || 0 != sched_load(argv[2])) {
+    fprintf(stderr, "usage: %s backend db [threads] [bookings]\n", argv[0]);
+    return 1;
+  }
+  made = calloc(threads, sizeof(size_t));
+  tids = malloc(threads * sizeof(pthread_t));
+  started = bench_now();
+  for (i = 0; i < threads; i++)
+    pthread_create(tids+i, NULL, booker, (void*)i);
+  for (i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+  took = bench_now() - started;
+  for (total = i = 0; i < threads; i++)
+    total += made[i];
+  printf("%-8s %lu bookers: %8.0f bookings/s, %lu made\n", argv[1],
+         (unsigned long)threads, threads * bookings / took,
+         (unsigned long)total);
+  free(tids);
+  free(made);
+  // every shared slot once, and every thread's own
+  expected = bookings / 2 + threads * (bookings / 2);
+  if (total != expected) {
+    fprintf(stderr, "%s: %lu bookings made, expected %lu\n", argv[1],
+            (unsigned long)total, (unsigned long)expected);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Times concurrent bookers on each backend, from a fresh database with two
+# rooms every time.
+# usage: bench/bookers.sh [threads] [bookings]
+# Needs the sqlite3 shell; run from the top of the tree after `make`.
+
+THREADS=${1:-32}
+BOOKINGS=${2:-200}
+DB=bench/bookers.db3
+
+set -e
+for backend in sqlite memory journal; do
+  rm -f $DB $DB-wal $DB-shm $DB.snapshot $DB.checkpoint $DB.journal*
+  # loading creates the schema; the missing batch script fails afterwards
+  ./sched -u 1 -c /nonexistent $DB 2>/dev/null || true
+  sqlite3 $DB <<EOF
+INSERT INTO room VALUES (1, 1, 100, 10, NULL), (2, 1, 100, 10, NULL);
+EOF
+  bench/bookers $backend $DB $THREADS $BOOKINGS
+done
+rm -f $DB $DB-wal $DB-shm $DB.snapshot $DB.checkpoint $DB.journal*
@@ -0,0 +1,78 @@
+/* Compares a room's conflict scan over a linked list of reservations (as
+ * the scheduler once walked them) with the scalar and vector versions of
+ * `overlap_find` over parallel arrays.
+ * usage: overlap [bookings] [rounds] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "overlap.h"
+#include "scheduler.h"
+
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Prints the time per booking compared, given `rounds` full scans of `n` */
+static void bench_report(const char *name, double started, size_t rounds,
+                         size_t n)
+{
+  printf("%-7s %6.2f ns/booking\n", name,
+         (bench_now() - started) / rounds / n * 1e9);
+}
+
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 4096;
+  size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : 20000;
+  reservation_t *list, *r;
+  int64_t *starts, *ends;
+  volatile size_t sink = 0;
+  double started;
+  size_t i, k;
+
+  if (n == 0 || rounds == 0) {
+    fprintf(stderr, "usage: %s [bookings] [rounds]\n", argv[0]);
+    return 1;
+  }
+  starts = malloc(n * sizeof(int64_t));
+  ends = malloc(n * sizeof(int64_t));
+  list = malloc(n * sizeof(reservation_t));
+  // the window checked comes before every booking, so each scan is full
+  for (i = 0; i < n; i++) {
+    starts[i] = list[i].start = i * 100 + 100;
+    ends[i] = list[i].end = i * 100 + 150;
+    list[i].next = i + 1 < n ? list + i + 1 : NULL;
+  }
+
+  started = bench_now();
+  for (i = 0; i < rounds; i++) {
+    for (r = list, k = 0; r; r = r->next, k++)
+      if (60 < r->end && 70 > r->start)
+        break;
+    sink += k;
+  }
+  bench_report("list", started, rounds, n);
+
+  started = bench_now();
+  for (i = 0; i < rounds; i++)
+    sink += overlap_find_scalar(starts, ends, n, 60, 70);
+  bench_report("scalar", started, rounds, n);
+
+  started = bench_now();
+  for (i = 0; i < rounds; i++)
+    sink += overlap_find(starts, ends, n, 60, 70);
+  bench_report("vector", started, rounds, n);
+
+  free(starts);
+  free(ends);
+  free(list);
+  return sink == 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Times the memory backend's startup on a generated database, first
+# rebuilding from SQLite (which also writes the snapshot) and then mapping
+# the snapshot it left behind.
+# usage: bench/startup.sh [reservations] [rooms]
+# Needs the sqlite3 shell; run from the top of the tree after `make`.
+
+RES=${1:-1000000}
+ROOMS=${2:-500}
+DB=bench/startup.db3
+
+set -e
+rm -f $DB $DB.snapshot $DB-wal $DB-shm
+# loading creates the schema; the missing batch script fails afterwards
+./sched -u 1 -c /nonexistent $DB 2>/dev/null || true
+sqlite3 $DB <<EOF
+INSERT INTO user VALUES (1, 2, 'bench@localhost');
+WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i < $ROOMS)
+  INSERT INTO room SELECT i, 1, 100, 10, NULL FROM n;
+WITH RECURSIVE n(i) AS (SELECT 0 UNION ALL SELECT i+1 FROM n WHERE i < $RES-1)
+  INSERT INTO reservation (room_id, user_id, start_time, end_time)
+  SELECT i % $ROOMS + 1, 1, i / $ROOMS * 3600 + 2000000000,
+         i / $ROOMS * 3600 + 2000001800 FROM n;
+EOF
+
+# an empty batch session loads everything and exits straight away
+startup()
+{
+  start=$(date +%s.%N)
+  ./sched -b memory -u 1 -c /dev/null $DB >/dev/null
+  end=$(date +%s.%N)
+  awk "BEGIN { printf \"%s %.2fs\\n\", \"$1\", $end - $start }"
+}
+
+echo "$RES reservations in $ROOMS rooms:"
+startup "  rebuild:      "
+startup "  from snapshot:"
+rm -f $DB $DB.snapshot $DB-wal $DB-shm
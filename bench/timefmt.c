@@ -0,0 +1,105 @@
+/* Compares formatting times for listings with `timefmt_ctime` against
+ * libc's `ctime` and `localtime_r` with `strftime`, over times in order
+ * (as in a listing) and at random, and checks that `timefmt_ctime` writes
+ * what `ctime` does, byte for byte, for every one of them.
+ * usage: timefmt [times]; set TZ to try other zones */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timefmt.h"
+
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Prints the time to format all `n` times */
+static void bench_report(const char *name, double started, size_t n)
+{
+  printf("  %-20s %8.2f ms\n", name, (bench_now() - started) * 1e3);
+}
+
+/* The number of times `timefmt_ctime` formats otherwise than `ctime`,
+ * after printing the first */
+static size_t bench_check(const time_t *times, size_t n)
+{
+  char out[TIMEFMT_SIZE];
+  const char *expect;
+  size_t len, bad, i;
+
+  for (bad = i = 0; i < n; i++) {
+    expect = ctime(times+i);
+    len = timefmt_ctime(times[i], out);
+    if (len == strlen(expect) - 1 && 0 == memcmp(out, expect, len))
+      continue;
+    if (bad++ == 0)
+      fprintf(stderr, "%ld: timefmt_ctime wrote \"%s\", ctime \"%.*s\"\n",
+              (long)times[i], out, (int)strlen(expect) - 1, expect);
+  }
+  return bad;
+}
+
+static void bench_run(const char *name, const time_t *times, size_t n)
+{
+  char out[TIMEFMT_SIZE];
+  volatile size_t sink = 0;
+  struct tm tm;
+  double started;
+  size_t i;
+
+  printf("%lu times %s:\n", (unsigned long)n, name);
+  started = bench_now();
+  for (i = 0; i < n; i++)
+    sink += ctime(times+i)[0];
+  bench_report("ctime", started, n);
+
+  started = bench_now();
+  for (i = 0; i < n; i++) {
+    localtime_r(times+i, &tm);
+    sink += strftime(out, sizeof(out), "%a %b %e %H:%M:%S %Y", &tm);
+  }
+  bench_report("localtime_r+strftime", started, n);
+
+  started = bench_now();
+  for (i = 0; i < n; i++)
+    sink += timefmt_ctime(times[i], out);
+  bench_report("timefmt_ctime", started, n);
+}
+
+
+int main(int argc, char **argv)
+{
+  size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+  time_t *sorted, *scattered;
+  size_t bad, i;
+
+  if (n == 0) {
+    fprintf(stderr, "usage: %s [times]\n", argv[0]);
+    return 1;
+  }
+  tzset();
+  srand(1);
+  sorted = malloc(n * sizeof(time_t));
+  scattered = malloc(n * sizeof(time_t));
+  // half-hour slots from 2024 on, crossing a few years' clock changes, and
+  // any second from 2014 to 2040
+  for (i = 0; i < n; i++) {
+    sorted[i] = 1704067200 + i * 1800;
+    scattered[i] = 1388534400 +
+      (time_t)((double)rand() / RAND_MAX * 820000000);
+  }
+  bench_run("in order", sorted, n);
+  bench_run("at random", scattered, n);
+  bad = bench_check(sorted, n) + bench_check(scattered, n);
+  printf("%lu times differ from ctime\n", (unsigned long)bad);
+  free(sorted);
+  free(scattered);
+  return bad != 0;
+}
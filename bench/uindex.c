@@ -0,0 +1,229 @@
+/* Compares listing a user's reservations (`u`) from the per-user index with
+ * the scans it replaced: every room's arrays, as the memory backend walked
+ * them, and the reservation table, which SQLite has no user index on.
+ * usage: uindex [users] [reservations] [rooms] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "sqlite3.h"
+#include "uindex.h"
+
+
+/* One room's reservations as parallel arrays sorted by start, as in the
+ * memory backend */
+typedef struct broom_s {
+  int64_t *start;
+  int64_t *end;
+  int32_t *id;
+  int32_t *user;
+  size_t count;
+} broom_t;
+
+
+static double bench_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Prints the time per `u` listing, given `rounds` of them */
+static void bench_report(const char *name, double started, size_t rounds)
+{
+  printf("%-14s %10.4f ms per u\n", name,
+         (bench_now() - started) / rounds * 1e3);
+}
+
+static long bench_rss_kb(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+static int compar_start(const void *a, const void *b)
+{
+  const reservation_t *x = a, *y = b;
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+/* The memory backend's `u` before the index: count, then fill and sort */
+static size_t scan_rooms(const broom_t *rooms, size_t room_c, int user,
+                         reservation_t **out)
+{
+  size_t count, i, j;
+
+  for (count = i = 0; i < room_c; i++)
+    for (j = 0; j < rooms[i].count; j++)
+      count += rooms[i].user[j] == user;
+  *out = realloc(*out, (count ? count : 1) * sizeof(reservation_t));
+  for (count = i = 0; i < room_c; i++) {
+    for (j = 0; j < rooms[i].count; j++) {
+      if (rooms[i].user[j] != user)
+        continue;
+      (*out)[count].next = NULL;
+      (*out)[count].id = rooms[i].id[j];
+      (*out)[count].room_id = i + 1;
+      (*out)[count].user_id = user;
+      (*out)[count].start = rooms[i].start[j];
+      (*out)[count].end = rooms[i].end[j];
+      count++;
+    }
+  }
+  qsort(*out, count, sizeof(reservation_t), compar_start);
+  return count;
+}
+
+/* The SQLite backend's `u` before the index: a count, then the rows */
+static size_t scan_table(sqlite3_stmt *count_stmt, sqlite3_stmt *select,
+                         int user, reservation_t **out)
+{
+  size_t count, n;
+
+  sqlite3_bind_int(count_stmt, 1, user);
+  sqlite3_step(count_stmt);
+  count = sqlite3_column_int(count_stmt, 0);
+  sqlite3_reset(count_stmt);
+  *out = realloc(*out, (count ? count : 1) * sizeof(reservation_t));
+  sqlite3_bind_int(select, 1, user);
+  for (n = 0; n < count && SQLITE_ROW == sqlite3_step(select); n++) {
+    (*out)[n].next = NULL;
+    (*out)[n].id = sqlite3_column_int(select, 0);
+    (*out)[n].room_id = sqlite3_column_int(select, 1);
+    (*out)[n].user_id = sqlite3_column_int(select, 2);
+    (*out)[n].start = sqlite3_column_int64(select, 3);
+    (*out)[n].end = sqlite3_column_int64(select, 4);
+  }
+  sqlite3_reset(select);
+  return n;
+}
+
+
+int main(int argc, char **argv)
+{
+  size_t users = argc > 1 ? strtoul(argv[1], NULL, 10) : 50000;
+  size_t n = argc > 2 ? strtoul(argv[2], NULL, 10) : 2000000;
+  size_t room_c = argc > 3 ? strtoul(argv[3], NULL, 10) : 2000;
+  const char insert_sql[] = "INSERT INTO reservation VALUES (?,?,?,?,?)";
+  const char count_sql[] =
+    "SELECT COUNT(*) FROM reservation WHERE user_id=?";
+  const char select_sql[] = "SELECT id, room_id, user_id, start_time, "
+    "end_time FROM reservation WHERE user_id=? ORDER BY start_time ASC";
+  broom_t *rooms;
+  reservation_t r, *out;
+  sqlite3 *db;
+  sqlite3_stmt *insert, *count_stmt, *select;
+  volatile size_t sink = 0;
+  double started;
+  long rss;
+  size_t per_room, i, j;
+
+  if (users == 0 || room_c == 0 || n < room_c) {
+    fprintf(stderr, "usage: %s [users] [reservations] [rooms]\n", argv[0]);
+    return 1;
+  }
+  srand(1);
+  per_room = n / room_c;
+  n = per_room * room_c;
+  rooms = malloc(room_c * sizeof(broom_t));
+  // every room is booked back to back, each hour by a random user
+  for (i = 0; i < room_c; i++) {
+    rooms[i].start = malloc(per_room * sizeof(int64_t));
+    rooms[i].end = malloc(per_room * sizeof(int64_t));
+    rooms[i].id = malloc(per_room * sizeof(int32_t));
+    rooms[i].user = malloc(per_room * sizeof(int32_t));
+    rooms[i].count = per_room;
+    for (j = 0; j < per_room; j++) {
+      rooms[i].start[j] = 2000000000 + j * 3600;
+      rooms[i].end[j] = rooms[i].start[j] + 1800;
+      rooms[i].id[j] = j * room_c + i + 1;
+      rooms[i].user[j] = rand() % users + 1;
+    }
+  }
+  printf("%lu users, %lu reservations in %lu rooms:\n",
+         (unsigned long)users, (unsigned long)n, (unsigned long)room_c);
+
+  rss = bench_rss_kb();
+  started = bench_now();
+  for (i = 0; i < room_c; i++) {
+    for (j = 0; j < per_room; j++) {
+      r.next = NULL;
+      r.id = rooms[i].id[j];
+      r.room_id = i + 1;
+      r.user_id = rooms[i].user[j];
+      r.start = rooms[i].start[j];
+      r.end = rooms[i].end[j];
+      uindex_add(&r);
+    }
+  }
+  // peak growth, so it includes the arrays' slack while they double
+  printf("%-14s %10.2f s, %ld bytes per reservation at peak\n", "index build",
+         bench_now() - started, (bench_rss_kb() - rss) * 1024 / (long)n);
+
+  out = NULL;
+  started = bench_now();
+  for (i = 0; i < 100000; i++) {
+    r.user_id = rand() % users + 1;
+    j = uindex_user(r.user_id, NULL);
+    out = realloc(out, (j ? j : 1) * sizeof(reservation_t));
+    sink += uindex_user(r.user_id, out);
+  }
+  bench_report("index", started, 100000);
+
+  started = bench_now();
+  for (i = 0; i < 200; i++)
+    sink += scan_rooms(rooms, room_c, rand() % users + 1, &out);
+  bench_report("memory scan", started, 200);
+
+  // the table as the SQLite backend has it, with no index on user_id
+  if (SQLITE_OK != sqlite3_open(":memory:", &db) ||
+      SQLITE_OK != sqlite3_exec(db, "CREATE TABLE reservation ("
+                                "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                                "room_id INTEGER NOT NULL,"
+                                "user_id INTEGER NOT NULL,"
+                                "start_time INTEGER NOT NULL,"
+                                "end_time INTEGER NOT NULL);"
+                                "BEGIN", NULL, NULL, NULL) ||
+      SQLITE_OK != sqlite3_prepare_v2(db, insert_sql, sizeof(insert_sql),
+                                      &insert, NULL)) {
+    fprintf(stderr, "%s\n", sqlite3_errmsg(db));
+    return 1;
+  }
+  for (i = 0; i < room_c; i++) {
+    for (j = 0; j < per_room; j++) {
+      sqlite3_bind_int(insert, 1, rooms[i].id[j]);
+      sqlite3_bind_int(insert, 2, i + 1);
+      sqlite3_bind_int(insert, 3, rooms[i].user[j]);
+      sqlite3_bind_int64(insert, 4, rooms[i].start[j]);
+      sqlite3_bind_int64(insert, 5, rooms[i].end[j]);
+      sqlite3_step(insert);
+      sqlite3_reset(insert);
+    }
+  }
+  sqlite3_finalize(insert);
+  sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  sqlite3_prepare_v2(db, count_sql, sizeof(count_sql), &count_stmt, NULL);
+  sqlite3_prepare_v2(db, select_sql, sizeof(select_sql), &select, NULL);
+  started = bench_now();
+  for (i = 0; i < 20; i++)
+    sink += scan_table(count_stmt, select, rand() % users + 1, &out);
+  bench_report("sqlite scan", started, 20);
+  sqlite3_finalize(count_stmt);
+  sqlite3_finalize(select);
+  sqlite3_close(db);
+
+  for (i = 0; i < room_c; i++) {
+    free(rooms[i].start);
+    free(rooms[i].end);
+    free(rooms[i].id);
+    free(rooms[i].user);
+  }
+  free(rooms);
+  free(out);
+  return sink == 0;
+}
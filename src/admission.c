@@ -0,0 +1,137 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "admission.h"
+
+
+/* Each class advances by STRIDE / weight per admission; the queued class
+ * that has advanced least goes next (stride scheduling). */
+#define ADMISSION_STRIDE (1 << 20)
+#define ADMISSION_CLASSES 3
+
+typedef struct waiter_s {
+  struct waiter_s *next;
+  int64_t since;
+  int granted;
+  pthread_cond_t cond;
+} waiter_t;
+
+static const uint64_t weight[ADMISSION_CLASSES] = {
+  ADMISSION_WEIGHT_STUDENT, ADMISSION_WEIGHT_FACULTY, ADMISSION_WEIGHT_ADMIN
+};
+static const int64_t target[ADMISSION_CLASSES] = {
+  ADMISSION_TARGET_STUDENT * 1000000LL, ADMISSION_TARGET_FACULTY * 1000000LL,
+  ADMISSION_TARGET_ADMIN * 1000000LL
+};
+
+static struct {
+  pthread_mutex_t lock;
+  size_t running;
+  size_t queued;
+  waiter_t *head[ADMISSION_CLASSES];
+  waiter_t *tail[ADMISSION_CLASSES];
+  uint64_t pass[ADMISSION_CLASSES];
+  uint64_t vtime;
+} adm = { PTHREAD_MUTEX_INITIALIZER };
+
+
+static int64_t admission_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* The class to admit next: whichever head has overrun its latency target
+ * the most, otherwise the least advanced by weight */
+static int admission_pick(void)
+{
+  int64_t now;
+  int64_t late, most;
+  int cls, c;
+
+  now = admission_now();
+  cls = -1;
+  most = 0;
+  for (c = 0; c < ADMISSION_CLASSES; c++) {
+    if (!adm.head[c])
+      continue;
+    // compare by how many targets overdue, so classes are on one scale
+    late = (now - adm.head[c]->since) * 16 / target[c];
+    if (late >= 16 && late > most) {
+      most = late;
+      cls = c;
+    }
+  }
+  if (cls >= 0)
+    return cls;
+  for (c = 0; c < ADMISSION_CLASSES; c++)
+    if (adm.head[c] && (cls < 0 || adm.pass[c] < adm.pass[cls]))
+      cls = c;
+  return cls;
+}
+
+/* Hands free slots to queued waiters; called with the lock held */
+static void admission_dispatch(void)
+{
+  waiter_t *w;
+  int cls;
+
+  while (adm.queued && adm.running < ADMISSION_SLOTS) {
+    cls = admission_pick();
+    w = adm.head[cls];
+    if (!(adm.head[cls] = w->next))
+      adm.tail[cls] = NULL;
+    adm.queued--;
+    adm.vtime = adm.pass[cls];
+    adm.pass[cls] += ADMISSION_STRIDE / weight[cls];
+    adm.running++;
+    w->granted = 1;
+    pthread_cond_signal(&w->cond);
+  }
+}
+
+
+void admission_enter(int cls)
+{
+  waiter_t w;
+
+  if (cls < 0 || cls >= ADMISSION_CLASSES)
+    cls = ADMISSION_STUDENT;
+  pthread_mutex_lock(&adm.lock);
+  if (adm.queued == 0 && adm.running < ADMISSION_SLOTS) {
+    adm.running++;
+    pthread_mutex_unlock(&adm.lock);
+    return;
+  }
+  w.next = NULL;
+  w.since = admission_now();
+  w.granted = 0;
+  pthread_cond_init(&w.cond, NULL);
+  // a class that was idle does not get to spend the turns it missed
+  if (!adm.head[cls]) {
+    if (adm.pass[cls] < adm.vtime)
+      adm.pass[cls] = adm.vtime;
+    adm.head[cls] = &w;
+  } else {
+    adm.tail[cls]->next = &w;
+  }
+  adm.tail[cls] = &w;
+  adm.queued++;
+  while (!w.granted)
+    pthread_cond_wait(&w.cond, &adm.lock);
+  pthread_mutex_unlock(&adm.lock);
+  pthread_cond_destroy(&w.cond);
+}
+
+
+void admission_leave(void)
+{
+  pthread_mutex_lock(&adm.lock);
+  adm.running--;
+  admission_dispatch();
+  pthread_mutex_unlock(&adm.lock);
+}
@@ -0,0 +1,50 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+/* Write operations allowed to run at once; the rest queue by class */
+#ifndef ADMISSION_SLOTS
+#define ADMISSION_SLOTS 4
+#endif
+
+/* Relative share of the slots each class gets while all are queued */
+#ifndef ADMISSION_WEIGHT_ADMIN
+#define ADMISSION_WEIGHT_ADMIN 64
+#endif
+#ifndef ADMISSION_WEIGHT_FACULTY
+#define ADMISSION_WEIGHT_FACULTY 2
+#endif
+#ifndef ADMISSION_WEIGHT_STUDENT
+#define ADMISSION_WEIGHT_STUDENT 4
+#endif
+
+/* Milliseconds a request of each class should wait at most; one that has
+ * waited longer goes ahead of the weighted order */
+#ifndef ADMISSION_TARGET_ADMIN
+#define ADMISSION_TARGET_ADMIN 5
+#endif
+#ifndef ADMISSION_TARGET_FACULTY
+#define ADMISSION_TARGET_FACULTY 500
+#endif
+#ifndef ADMISSION_TARGET_STUDENT
+#define ADMISSION_TARGET_STUDENT 250
+#endif
+
+/* The classes, numbered as the `status` of a user */
+#define ADMISSION_STUDENT 0
+#define ADMISSION_FACULTY 1
+#define ADMISSION_ADMIN 2
+
+
+/**
+ * @brief Blocks until a write operation of class `cls` may run
+ * Every call must be paired with `admission_leave`.  Unknown classes are
+ * treated as students.
+ */
+void admission_enter(int cls);
+
+/**
+ * @brief Ends a write operation and admits the next queued one, if any
+ */
+void admission_leave(void);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+
+/**
+ * A storage engine for the scheduler.
+ * The functions in `scheduler.c` implement policy (locking, permissions,
+ * notifications); a backend only stores and retrieves rows.
+ * Unless stated otherwise, functions return 0 on success.
+ */
+typedef struct backend_s {
+  const char *name;
+  /* Opens or seeds the store from the database at `dbpath` */
+  int (*load)(const char *dbpath);
+  /* Non-zero if there is no such user/room */
+  int (*user)(int id, user_t *user);
+  int (*room)(int id, room_t *room);
+  /* As `sched_rooms`, `sched_reservations_room` (users' reservations are
+   * indexed by the scheduler); the `next` field of filled reservations is
+   * left to the caller */
+  ssize_t (*rooms)(room_t *rooms);
+  /* A number that changes whenever any room does, negative on failure;
+   * NULL if the rooms cannot change once loaded */
+  long (*rooms_version)(void);
+  ssize_t (*reservations_room)(int room, reservation_t *reservations);
+  /* As `sched_page_room`: up to `max` of the room's reservations that come
+   * after `after` in (start, id) order, or its first ones if it is NULL */
+  ssize_t (*page_room)(int room, const reservation_t *after,
+                       reservation_t *reservations, size_t max);
+  /* The changes below are numbered 1, 2, 3... in the order they are
+   * committed, and each call sets `*order` to the number it took, or 0 if
+   * it took none.  A call that took a number and then failed to commit
+   * still reports it, so the scheduler can skip it. */
+  /* Stores `count` reservations, none of which may overlap another, and
+   * sets their `id`.
+   * The conflict check and the insert are one atomic step: if any of them
+   * overlaps a stored reservation or names no room, none are stored.
+   * Returns 1 if the batch was refused, negative on failure. */
+  int (*reserve)(reservation_t *reservations, size_t count, uint64_t *order);
+  /* Deletes reservations in a room covering [start, end], limited to those
+   * owned by `user_id` unless it is negative.  The deleted reservations are
+   * returned in a malloc'd array through `removed`.
+   * Returns the number deleted, negative on failure. */
+  ssize_t (*remove)(int roomid, time_t start, time_t end, int user_id,
+                    reservation_t **removed, uint64_t *order);
+  /* Deletes the reservation `reservation->id`, which is stored in its room
+   * at its start time as given.
+   * Returns 1 if there is no such reservation, negative on failure. */
+  int (*remove_id)(const reservation_t *reservation, uint64_t *order);
+  /* Blocks until the `reserve` and `remove(_id)` calls made by this thread are
+   * durable; NULL if they already are when they return.
+   * Returns negative if they could not be made durable. */
+  int (*sync)(void);
+  /* As `sched_export` */
+  int (*export)(int fd, int format);
+  /* Moves reservations that ended before `before` into the history store.
+   * Returns the number moved, negative on failure. */
+  ssize_t (*archive)(time_t before);
+  /* As `sched_history_room`, `sched_history_user`, read under one lock or
+   * transaction; the `next` field is left to the caller */
+  ssize_t (*history_room)(int room, reservation_t **reservations);
+  ssize_t (*history_user)(int user, reservation_t **reservations);
+} backend_t;
+
+
+extern const backend_t backend_sqlite;
+extern const backend_t backend_memory;
+extern const backend_t backend_journal;
+
+#endif
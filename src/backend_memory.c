@@ -0,0 +1,1236 @@
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "export.h"
+#include "journal.h"
+#include "minutes.h"
+#include "overlap.h"
+#include "snapshot.h"
+#include "sqlite3.h"
+
+#ifndef SNAPSHOT_DELTA
+#define SNAPSHOT_DELTA 65536
+#endif
+
+
+/* A single reservation of the memory backend; the room is implied by the
+ * room it is stored in. */
+typedef sres_t mres_t;
+
+/* Each room stores its reservations sorted by start as parallel arrays, so
+ * conflict checks scan nothing but contiguous starts and ends.  These are
+ * the snapshot's layouts; arrays borrowed from a snapshot have a capacity
+ * of 0 and are copied before they are first modified.  Archived
+ * reservations, which pile up for years, are kept packed to minutes in
+ * `hist`, apart from the few whose times do not pack, kept in `hwide`. */
+typedef struct mroom_s {
+  room_t room;
+  int64_t *start;
+  int64_t *end;
+  int32_t *id;
+  int32_t *user;
+  size_t count;
+  size_t cap;
+  cres_t *hist;
+  size_t hist_c;
+  size_t hist_cap;
+  mres_t *hwide;
+  size_t hwide_c;
+  size_t hwide_cap;
+} mroom_t;
+
+
+static mroom_t *rooms = NULL;
+static size_t room_c = 0;
+static user_t *users = NULL;
+static size_t user_c = 0;
+static int users_mapped = 0;
+static int next_id = 0;
+/* The number of the last change made, see `backend_t` */
+static uint64_t committed = 0;
+static pthread_rwlock_t memlock = PTHREAD_RWLOCK_INITIALIZER;
+static int journaled = 0;
+static char *snapshot_path = NULL;
+/* The last journal record written by this thread, see `mem_sync` */
+static __thread uint64_t unsynced = 0;
+
+
+static int compar_room(const void *a, const void *b)
+{ return ((mroom_t*)a)->room.id - ((mroom_t*)b)->room.id; }
+
+static int compar_user(const void *a, const void *b)
+{ return ((user_t*)a)->id - ((user_t*)b)->id; }
+
+static int compar_index(const void *a, const void *b)
+{ return ((sindex_t*)a)->room_id - ((sindex_t*)b)->room_id; }
+
+static int compar_reservation(const void *a, const void *b)
+{
+  const reservation_t *ra = a, *rb = b;
+  return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+static mroom_t *mem_find_room(int id)
+{
+  mroom_t key;
+  key.room.id = id;
+  return bsearch(&key, rooms, room_c, sizeof(mroom_t), compar_room);
+}
+
+static user_t *mem_find_user(int id)
+{
+  user_t key;
+  key.id = id;
+  return bsearch(&key, users, user_c, sizeof(user_t), compar_user);
+}
+
+/* Index of the first reservation in the room starting after `start` */
+static size_t mem_upper(const mroom_t *room, time_t start)
+{
+  size_t lo = 0, hi = room->count, mid;
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (room->start[mid] <= start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static void *mem_copy(const void *src, size_t size, size_t count, size_t cap)
+{
+  void *copy = malloc(size * cap);
+  memcpy(copy, src, size * count);
+  return copy;
+}
+
+static void mem_own(mroom_t *room)
+{
+  size_t cap;
+
+  if (room->cap != 0)
+    return;
+  if (room->count == 0) {
+    room->start = room->end = NULL;
+    room->id = room->user = NULL;
+    return;
+  }
+  cap = room->count * 2;
+  room->start = mem_copy(room->start, sizeof(int64_t), room->count, cap);
+  room->end = mem_copy(room->end, sizeof(int64_t), room->count, cap);
+  room->id = mem_copy(room->id, sizeof(int32_t), room->count, cap);
+  room->user = mem_copy(room->user, sizeof(int32_t), room->count, cap);
+  room->cap = cap;
+}
+
+static void mem_get(const mroom_t *room, size_t i, mres_t *res)
+{
+  res->id = room->id[i];
+  res->user_id = room->user[i];
+  res->start = room->start[i];
+  res->end = room->end[i];
+}
+
+static void mem_set(mroom_t *room, size_t i, const mres_t *res)
+{
+  room->id[i] = res->id;
+  room->user[i] = res->user_id;
+  room->start[i] = res->start;
+  room->end[i] = res->end;
+}
+
+static void mem_shift(mroom_t *room, size_t to, size_t from, size_t n)
+{
+  memmove(room->start+to, room->start+from, n * sizeof(int64_t));
+  memmove(room->end+to, room->end+from, n * sizeof(int64_t));
+  memmove(room->id+to, room->id+from, n * sizeof(int32_t));
+  memmove(room->user+to, room->user+from, n * sizeof(int32_t));
+}
+
+static void mem_append(mroom_t *room, const mres_t *res)
+{
+  size_t at;
+
+  mem_own(room);
+  if (room->count == room->cap) {
+    room->cap = room->cap ? room->cap * 2 : 8;
+    room->start = realloc(room->start, room->cap * sizeof(int64_t));
+    room->end = realloc(room->end, room->cap * sizeof(int64_t));
+    room->id = realloc(room->id, room->cap * sizeof(int32_t));
+    room->user = realloc(room->user, room->cap * sizeof(int32_t));
+  }
+  at = mem_upper(room, res->start);
+  mem_shift(room, at+1, at, room->count-at);
+  mem_set(room, at, res);
+  room->count++;
+}
+
+static void mem_delete(mroom_t *room, size_t i)
+{
+  mem_shift(room, i, i+1, room->count-i-1);
+  room->count--;
+}
+
+/* Non-zero if any reservation in the room overlaps [start, end).
+ * Only reservations starting before `end` can overlap, so the scan is cut
+ * off there and the rest handed to the vectorised kernel. */
+static int mem_overlaps(const mroom_t *room, time_t start, time_t end)
+{
+  size_t n = mem_upper(room, end - 1);
+  return overlap_find(room->start, room->end, n, start, end) != n;
+}
+
+/* Archived reservations are only ever appended, in the order they aged */
+static void mem_hist_append(mroom_t *room, const mres_t *res)
+{
+  cres_t packed;
+
+  if (0 == cres_pack(&packed, res->id, res->user_id, res->start, res->end)) {
+    if (room->hist_c == room->hist_cap) {
+      room->hist_cap = room->hist_cap ? room->hist_cap * 2 : 8;
+      room->hist = realloc(room->hist, room->hist_cap * sizeof(cres_t));
+    }
+    room->hist[room->hist_c++] = packed;
+  } else {
+    if (room->hwide_c == room->hwide_cap) {
+      room->hwide_cap = room->hwide_cap ? room->hwide_cap * 2 : 8;
+      room->hwide = realloc(room->hwide, room->hwide_cap * sizeof(mres_t));
+    }
+    room->hwide[room->hwide_c++] = *res;
+  }
+}
+
+/* The `i`th of a room's hist_c + hwide_c archived reservations */
+static void mem_hist_get(const mroom_t *room, size_t i, mres_t *res)
+{
+  if (i >= room->hist_c) {
+    *res = room->hwide[i - room->hist_c];
+    return;
+  }
+  res->id = room->hist[i].id;
+  res->user_id = room->hist[i].other;
+  cres_unpack(room->hist+i, &res->start, &res->end);
+}
+
+/* Moves a room's reservations that ended before `before` to its history */
+static size_t mem_archive_room(mroom_t *room, time_t before)
+{
+  mres_t res;
+  size_t i, j;
+
+  mem_own(room);
+  for (i = j = 0; i < room->count; i++) {
+    mem_get(room, i, &res);
+    if (res.end < before)
+      mem_hist_append(room, &res);
+    else
+      mem_set(room, j++, &res);
+  }
+  room->count = j;
+  return i - j;
+}
+
+static void mem_fill(reservation_t *r, const mroom_t *room, const mres_t *res)
+{
+  r->next = NULL;
+  r->id = res->id;
+  r->room_id = room->room.id;
+  r->user_id = res->user_id;
+  r->start = res->start;
+  r->end = res->end;
+}
+
+static void mem_fill_at(reservation_t *r, const mroom_t *room, size_t i)
+{
+  r->next = NULL;
+  r->id = room->id[i];
+  r->room_id = room->room.id;
+  r->user_id = room->user[i];
+  r->start = room->start[i];
+  r->end = room->end[i];
+}
+
+static void mem_reset(void)
+{
+  size_t i;
+
+  for (i = 0; i < room_c; i++) {
+    if (rooms[i].cap) {
+      free(rooms[i].start);
+      free(rooms[i].end);
+      free(rooms[i].id);
+      free(rooms[i].user);
+    }
+    free(rooms[i].hist);
+    free(rooms[i].hwide);
+  }
+  free(rooms);
+  if (!users_mapped)
+    free(users);
+  rooms = NULL;
+  users = NULL;
+  room_c = user_c = 0;
+  users_mapped = 0;
+  next_id = 0;
+}
+
+
+/* Loads the room and user catalog from the sqlite database */
+static int mem_seed_catalog(sqlite3 *sdb)
+{
+  sqlite3_stmt *stmt;
+  size_t cap;
+  mroom_t *room;
+
+  cap = 0;
+  if (SQLITE_OK != sqlite3_prepare_v2(sdb, "SELECT * FROM room", -1,
+                                      &stmt, NULL))
+    return -1;
+  while (SQLITE_ROW == sqlite3_step(stmt)) {
+    if (room_c == cap) {
+      cap = cap ? cap * 2 : 64;
+      rooms = realloc(rooms, cap * sizeof(mroom_t));
+    }
+    room = rooms + room_c++;
+    memset(room, 0, sizeof(mroom_t));
+    room->room.id = sqlite3_column_int(stmt, 0);
+    room->room.size = sqlite3_column_int(stmt, 1);
+    room->room.sqft = sqlite3_column_int(stmt, 2);
+    room->room.capacity = sqlite3_column_int(stmt, 3);
+    if (sqlite3_column_text(stmt, 4) != NULL)
+      strncpy(room->room.note, (const char*)sqlite3_column_text(stmt, 4), 63);
+  }
+  sqlite3_finalize(stmt);
+  qsort(rooms, room_c, sizeof(mroom_t), compar_room);
+
+  cap = 0;
+  if (SQLITE_OK != sqlite3_prepare_v2(sdb, "SELECT * FROM user", -1,
+                                      &stmt, NULL))
+    return -1;
+  while (SQLITE_ROW == sqlite3_step(stmt)) {
+    if (user_c == cap) {
+      cap = cap ? cap * 2 : 64;
+      users = realloc(users, cap * sizeof(user_t));
+    }
+    memset(users+user_c, 0, sizeof(user_t));
+    users[user_c].id = sqlite3_column_int(stmt, 0);
+    users[user_c].status = sqlite3_column_int(stmt, 1);
+    strncpy(users[user_c].email,
+            (const char*)sqlite3_column_text(stmt, 2), 63);
+    user_c++;
+  }
+  sqlite3_finalize(stmt);
+  qsort(users, user_c, sizeof(user_t), compar_user);
+  return 0;
+}
+
+/* Loads the reservations with ids above `after` from the sqlite database.
+ * Returns the number loaded, negative on failure. */
+static ssize_t mem_seed_reservations(sqlite3 *sdb, int after)
+{
+  sqlite3_stmt *stmt;
+  mroom_t *room;
+  mres_t res;
+  ssize_t count;
+
+  if (SQLITE_OK != sqlite3_prepare_v2(sdb, "SELECT id, room_id, user_id, "
+                                      "start_time, end_time FROM reservation "
+                                      "WHERE id>? ORDER BY room_id, start_time",
+                                      -1, &stmt, NULL))
+    return -1;
+  sqlite3_bind_int(stmt, 1, after);
+  room = NULL;
+  count = 0;
+  while (SQLITE_ROW == sqlite3_step(stmt)) {
+    res.id = sqlite3_column_int(stmt, 0);
+    res.user_id = sqlite3_column_int(stmt, 2);
+    res.start = sqlite3_column_int64(stmt, 3);
+    res.end = sqlite3_column_int64(stmt, 4);
+    if (!room || room->room.id != sqlite3_column_int(stmt, 1))
+      room = mem_find_room(sqlite3_column_int(stmt, 1));
+    if (room)
+      mem_append(room, &res);
+    if (res.id > next_id)
+      next_id = res.id;
+    count++;
+  }
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+/* Loads the archived reservations from the sqlite database, if any */
+static void mem_seed_history(sqlite3 *sdb)
+{
+  sqlite3_stmt *stmt;
+  mroom_t *room;
+  mres_t res;
+
+  if (SQLITE_OK != sqlite3_prepare_v2(sdb, "SELECT id, room_id, user_id, "
+                                      "start_time, end_time "
+                                      "FROM reservation_history "
+                                      "ORDER BY room_id, end_time",
+                                      -1, &stmt, NULL))
+    return;
+  room = NULL;
+  while (SQLITE_ROW == sqlite3_step(stmt)) {
+    res.id = sqlite3_column_int(stmt, 0);
+    res.user_id = sqlite3_column_int(stmt, 2);
+    res.start = sqlite3_column_int64(stmt, 3);
+    res.end = sqlite3_column_int64(stmt, 4);
+    if (!room || room->room.id != sqlite3_column_int(stmt, 1))
+      room = mem_find_room(sqlite3_column_int(stmt, 1));
+    if (room)
+      mem_hist_append(room, &res);
+    if (res.id > next_id)
+      next_id = res.id;
+  }
+  sqlite3_finalize(stmt);
+}
+
+/* Non-zero if the database's catalog differs from the snapshot's */
+static int mem_catalog_changed(sqlite3 *sdb, const snapshot_t *snap)
+{
+  sqlite3_stmt *stmt;
+  int changed;
+
+  if (!sdb)
+    return 0;
+  if (SQLITE_OK != sqlite3_prepare_v2(sdb, "SELECT "
+                                      "(SELECT COUNT(*) FROM room), "
+                                      "(SELECT MAX(id) FROM room), "
+                                      "(SELECT COUNT(*) FROM user), "
+                                      "(SELECT MAX(id) FROM user)",
+                                      -1, &stmt, NULL))
+    return 0;
+  changed = 1;
+  if (SQLITE_ROW == sqlite3_step(stmt))
+    changed = (size_t)sqlite3_column_int64(stmt, 0) != snap->room_c ||
+      (snap->room_c &&
+       sqlite3_column_int(stmt, 1) != snap->rooms[snap->room_c-1].id) ||
+      (size_t)sqlite3_column_int64(stmt, 2) != snap->user_c ||
+      (snap->user_c &&
+       sqlite3_column_int(stmt, 3) != snap->users[snap->user_c-1].id);
+  sqlite3_finalize(stmt);
+  return changed;
+}
+
+/* Non-zero if the database's reservations up to the snapshot's last id
+ * are not the ones in the snapshot (i.e. some were deleted since) */
+static int mem_reservations_changed(sqlite3 *sdb, const snapshot_t *snap)
+{
+  sqlite3_stmt *stmt;
+  int changed;
+
+  if (SQLITE_OK != sqlite3_prepare_v2(sdb, "SELECT COUNT(*) FROM reservation "
+                                      "WHERE id<=? AND room_id IN "
+                                      "(SELECT id FROM room)",
+                                      -1, &stmt, NULL))
+    return 1;
+  sqlite3_bind_int64(stmt, 1, snap->next_id);
+  changed = 1;
+  if (SQLITE_ROW == sqlite3_step(stmt))
+    changed = (size_t)sqlite3_column_int64(stmt, 0) != snap->res_c;
+  sqlite3_finalize(stmt);
+  return changed;
+}
+
+static void mem_borrow(mroom_t *room, const snapshot_t *snap,
+                       uint64_t first, uint64_t count)
+{
+  room->start = (int64_t*)(snap->res_start + first);
+  room->end = (int64_t*)(snap->res_end + first);
+  room->id = (int32_t*)(snap->res_id + first);
+  room->user = (int32_t*)(snap->res_user + first);
+  room->count = count;
+  room->cap = 0;
+}
+
+/* Archived reservations are packed out of the snapshot rather than used
+ * in place; the mapped pages they came from are then left untouched. */
+static void mem_unpack_history(mroom_t *room, const snapshot_t *snap,
+                               const sindex_t *hindex)
+{
+  uint64_t i;
+
+  for (i = 0; i < hindex->count; i++)
+    mem_hist_append(room, snap->hres + hindex->first + i);
+}
+
+/* Uses a mapped snapshot as the in-memory state without copying the
+ * interval arrays.  If the database's catalog has changed since, the
+ * catalog is taken from the database and the arrays attached by room. */
+static void mem_attach(sqlite3 *sdb, const snapshot_t *snap)
+{
+  const sindex_t *found;
+  sindex_t key;
+  size_t i;
+
+  mem_reset();
+  if (mem_catalog_changed(sdb, snap) && 0 == mem_seed_catalog(sdb)) {
+    for (i = 0; i < room_c; i++) {
+      key.room_id = rooms[i].room.id;
+      if ((found = bsearch(&key, snap->index, snap->room_c, sizeof(sindex_t),
+                           compar_index))) {
+        mem_borrow(rooms+i, snap, found->first, found->count);
+        mem_unpack_history(rooms+i, snap,
+                           snap->hindex + (found - snap->index));
+      }
+    }
+  } else {
+    mem_reset();
+    rooms = malloc((snap->room_c ? snap->room_c : 1) * sizeof(mroom_t));
+    room_c = snap->room_c;
+    for (i = 0; i < room_c; i++) {
+      memset(rooms+i, 0, sizeof(mroom_t));
+      rooms[i].room = snap->rooms[i];
+      mem_borrow(rooms+i, snap, snap->index[i].first, snap->index[i].count);
+      mem_unpack_history(rooms+i, snap, snap->hindex+i);
+    }
+    users = (user_t*)snap->users;
+    user_c = snap->user_c;
+    users_mapped = 1;
+  }
+  next_id = snap->next_id;
+}
+
+/* Copies the in-memory state into a snapshot; memlock held.
+ * Users never change after loading, so they are shared rather than copied. */
+static void mem_capture(snapshot_t *snap, uint64_t generation)
+{
+  room_t *srooms;
+  sindex_t *index, *hindex;
+  int64_t *start, *end;
+  int32_t *id, *user;
+  sres_t *hres;
+  size_t i, j, n, h;
+
+  for (n = h = i = 0; i < room_c; i++) {
+    n += rooms[i].count;
+    h += rooms[i].hist_c + rooms[i].hwide_c;
+  }
+  srooms = malloc((room_c ? room_c : 1) * sizeof(room_t));
+  index = malloc((room_c ? room_c : 1) * sizeof(sindex_t));
+  hindex = malloc((room_c ? room_c : 1) * sizeof(sindex_t));
+  start = malloc((n ? n : 1) * sizeof(int64_t));
+  end = malloc((n ? n : 1) * sizeof(int64_t));
+  id = malloc((n ? n : 1) * sizeof(int32_t));
+  user = malloc((n ? n : 1) * sizeof(int32_t));
+  hres = malloc((h ? h : 1) * sizeof(sres_t));
+  for (n = h = i = 0; i < room_c; i++) {
+    srooms[i] = rooms[i].room;
+    index[i].room_id = hindex[i].room_id = rooms[i].room.id;
+    index[i].pad = hindex[i].pad = 0;
+    index[i].first = n;
+    index[i].count = rooms[i].count;
+    memcpy(start+n, rooms[i].start, rooms[i].count * sizeof(int64_t));
+    memcpy(end+n, rooms[i].end, rooms[i].count * sizeof(int64_t));
+    memcpy(id+n, rooms[i].id, rooms[i].count * sizeof(int32_t));
+    memcpy(user+n, rooms[i].user, rooms[i].count * sizeof(int32_t));
+    n += rooms[i].count;
+    hindex[i].first = h;
+    hindex[i].count = rooms[i].hist_c + rooms[i].hwide_c;
+    for (j = 0; j < hindex[i].count; j++)
+      mem_hist_get(rooms+i, j, hres+h+j);
+    h += hindex[i].count;
+  }
+  snap->generation = generation;
+  snap->next_id = next_id;
+  snap->rooms = srooms;
+  snap->room_c = room_c;
+  snap->users = users;
+  snap->user_c = user_c;
+  snap->index = index;
+  snap->res_start = start;
+  snap->res_end = end;
+  snap->res_id = id;
+  snap->res_user = user;
+  snap->res_c = n;
+  snap->hindex = hindex;
+  snap->hres = hres;
+  snap->hres_c = h;
+  snap->map = NULL;
+  snap->map_size = 0;
+}
+
+static void mem_release(snapshot_t *snap)
+{
+  free((void*)snap->rooms);
+  free((void*)snap->index);
+  free((void*)snap->res_start);
+  free((void*)snap->res_end);
+  free((void*)snap->res_id);
+  free((void*)snap->res_user);
+  free((void*)snap->hindex);
+  free((void*)snap->hres);
+}
+
+static int mem_save(uint64_t generation)
+{
+  snapshot_t snap;
+  int status;
+
+  mem_capture(&snap, generation);
+  status = snapshot_write(snapshot_path, &snap);
+  mem_release(&snap);
+  return status;
+}
+
+static void mem_paths(const char *dbpath, const char *suffix)
+{
+  free(snapshot_path);
+  snapshot_path = malloc(strlen(dbpath) + strlen(suffix) + 1);
+  sprintf(snapshot_path, "%s%s", dbpath, suffix);
+}
+
+
+/* Starts from the snapshot next to the database plus the reservations
+ * added to the database since; nothing is ever written back to it. */
+static int mem_load(const char *dbpath)
+{
+  sqlite3 *sdb;
+  snapshot_t snap;
+  ssize_t delta;
+  int mapped;
+
+  pthread_rwlock_wrlock(&memlock);
+  mem_paths(dbpath, ".snapshot");
+  if (SQLITE_OK != sqlite3_open_v2(dbpath, &sdb, SQLITE_OPEN_READONLY, NULL)) {
+    syslog(LOG_WARNING, "memory backend starting without seed data: %s",
+           sqlite3_errmsg(sdb));
+    sqlite3_close(sdb);
+    pthread_rwlock_unlock(&memlock);
+    return 0;
+  }
+  delta = -1;
+  mapped = (0 == snapshot_map(snapshot_path, &snap));
+  if (mapped && !mem_reservations_changed(sdb, &snap)) {
+    mem_attach(sdb, &snap);
+    delta = mem_seed_reservations(sdb, snap.next_id);
+  }
+  if (delta < 0) {
+    // no usable snapshot: rebuild everything from the database
+    // after the reset nothing points into the mapping any more
+    mem_reset();
+    if (mapped)
+      snapshot_unmap(&snap);
+    if (0 != mem_seed_catalog(sdb) || 0 > mem_seed_reservations(sdb, 0))
+      syslog(LOG_WARNING, "memory backend starting without seed data: %s",
+             sqlite3_errmsg(sdb));
+    mem_seed_history(sdb);
+  }
+  if (delta < 0 || delta > SNAPSHOT_DELTA)
+    mem_save(0);
+  sqlite3_close(sdb);
+  pthread_rwlock_unlock(&memlock);
+  return 0;
+}
+
+
+/* Applies a replayed journal record */
+static void mem_apply(const jrec_t *rec)
+{
+  mroom_t *room;
+  mres_t res;
+  size_t i;
+
+  if (rec->op == JOURNAL_ARCHIVE) {
+    for (i = 0; i < room_c; i++)
+      mem_archive_room(rooms+i, rec->start);
+    return;
+  }
+  if (!(room = mem_find_room(rec->room_id)))
+    return;
+  if (rec->op == JOURNAL_RESERVE) {
+    res.id = rec->id;
+    res.user_id = rec->user_id;
+    res.start = rec->start;
+    res.end = rec->end;
+    mem_append(room, &res);
+    if (res.id > next_id)
+      next_id = res.id;
+  } else if (rec->op == JOURNAL_REMOVE) {
+    mem_own(room);
+    for (i = mem_upper(room, rec->start); i > 0; i--) {
+      if (room->id[i-1] == rec->id) {
+        mem_delete(room, i-1);
+        break;
+      }
+    }
+  }
+}
+
+/* Called from the journal's sync thread when the journal grows too long.
+ * The state is copied under the lock together with the journal rotation,
+ * so the checkpoint covers exactly the journals up to the rotated one. */
+static void mem_checkpoint(void)
+{
+  snapshot_t snap;
+  uint64_t gen;
+
+  pthread_rwlock_wrlock(&memlock);
+  gen = journal_rotate();
+  mem_capture(&snap, gen);
+  pthread_rwlock_unlock(&memlock);
+  // if this one fails, the next checkpoint retires this journal too
+  if (gen && 0 == snapshot_write(snapshot_path, &snap))
+    journal_retire(gen);
+  mem_release(&snap);
+}
+
+static int jnl_load(const char *dbpath)
+{
+  sqlite3 *sdb;
+  snapshot_t snap;
+  char *path;
+  uint64_t ckpt_gen, gen;
+  int mapped;
+  int status;
+
+  pthread_rwlock_wrlock(&memlock);
+  mem_paths(dbpath, ".checkpoint");
+  if (SQLITE_OK != sqlite3_open_v2(dbpath, &sdb, SQLITE_OPEN_READONLY, NULL)) {
+    sqlite3_close(sdb);
+    sdb = NULL;
+  }
+  path = malloc(strlen(dbpath) + 9);
+  sprintf(path, "%s.journal", dbpath);
+  if ((mapped = (0 == snapshot_map(snapshot_path, &snap)))) {
+    mem_attach(sdb, &snap);
+    ckpt_gen = snap.generation;
+  } else {
+    // the first run imports the reservations already in the database
+    mem_reset();
+    ckpt_gen = 0;
+    if (!sdb || 0 != mem_seed_catalog(sdb) ||
+        0 > mem_seed_reservations(sdb, 0))
+      syslog(LOG_WARNING, "journal backend starting without a catalog");
+    else
+      mem_seed_history(sdb);
+  }
+  sqlite3_close(sdb);
+  gen = journal_replay(path, ckpt_gen, mem_apply);
+  // compact whatever was replayed before the journal file is reused
+  status = 0;
+  if (gen != ckpt_gen || !mapped)
+    status = mem_save(gen);
+  if (status == 0)
+    status = journal_open(path, gen+1, mem_checkpoint);
+  if (status == 0)
+    journal_retire(gen);
+  journaled = (status == 0);
+  free(path);
+  pthread_rwlock_unlock(&memlock);
+  return status;
+}
+
+
+static int mem_user(int id, user_t *user)
+{
+  user_t *found;
+
+  pthread_rwlock_rdlock(&memlock);
+  if ((found = mem_find_user(id)))
+    *user = *found;
+  pthread_rwlock_unlock(&memlock);
+  return found ? 0 : 1;
+}
+
+
+static int mem_room(int id, room_t *room)
+{
+  mroom_t *found;
+
+  pthread_rwlock_rdlock(&memlock);
+  if ((found = mem_find_room(id)))
+    *room = found->room;
+  pthread_rwlock_unlock(&memlock);
+  return found ? 0 : 1;
+}
+
+
+static ssize_t mem_rooms(room_t *out)
+{
+  size_t i;
+
+  pthread_rwlock_rdlock(&memlock);
+  if (out)
+    for (i = 0; i < room_c; i++)
+      out[i] = rooms[i].room;
+  i = room_c;
+  pthread_rwlock_unlock(&memlock);
+  return i;
+}
+
+
+static ssize_t mem_reservations_room(int id, reservation_t *reservations)
+{
+  mroom_t *room;
+  size_t i;
+
+  pthread_rwlock_rdlock(&memlock);
+  if (!(room = mem_find_room(id))) {
+    pthread_rwlock_unlock(&memlock);
+    return 0;
+  }
+  if (reservations)
+    for (i = 0; i < room->count; i++)
+      mem_fill_at(reservations+i, room, i);
+  i = room->count;
+  pthread_rwlock_unlock(&memlock);
+  return i;
+}
+
+
+static ssize_t mem_page_room(int id, const reservation_t *after,
+                             reservation_t *reservations, size_t max)
+{
+  mroom_t *room;
+  size_t i, n;
+
+  pthread_rwlock_rdlock(&memlock);
+  if (!(room = mem_find_room(id))) {
+    pthread_rwlock_unlock(&memlock);
+    return 0;
+  }
+  // resume just past the last one sent, or past every one sharing its
+  // start if it has since been deleted
+  i = after ? mem_upper(room, after->start) : 0;
+  for (n = i; after && n > 0 && room->start[n-1] == after->start; n--)
+    if (room->id[n-1] == after->id) {
+      i = n;
+      break;
+    }
+  for (n = 0; n < max && i < room->count; n++, i++)
+    mem_fill_at(reservations+n, room, i);
+  pthread_rwlock_unlock(&memlock);
+  return n;
+}
+
+
+static int mem_reserve(reservation_t *reservations, size_t count,
+                       uint64_t *order)
+{
+  mroom_t *room;
+  mres_t res;
+  jrec_t *recs;
+  uint64_t seq;
+  size_t i;
+
+  seq = 0;
+  *order = 0;
+  recs = journaled ? malloc(count * sizeof(jrec_t)) : NULL;
+  pthread_rwlock_wrlock(&memlock);
+  for (i = 0; i < count; i++) {
+    room = mem_find_room(reservations[i].room_id);
+    if (!room || mem_overlaps(room, reservations[i].start,
+                              reservations[i].end)) {
+      pthread_rwlock_unlock(&memlock);
+      free(recs);
+      return 1;
+    }
+  }
+  for (i = 0; i < count; i++) {
+    reservations[i].id = next_id + 1 + i;
+    if (recs) {
+      memset(recs+i, 0, sizeof(jrec_t));
+      recs[i].op = JOURNAL_RESERVE;
+      recs[i].room_id = reservations[i].room_id;
+      recs[i].id = reservations[i].id;
+      recs[i].user_id = reservations[i].user_id;
+      recs[i].start = reservations[i].start;
+      recs[i].end = reservations[i].end;
+    }
+  }
+  // journaled first, so a journal that has failed leaves the rooms alone
+  if (recs && !(seq = journal_append_batch(recs, count))) {
+    pthread_rwlock_unlock(&memlock);
+    free(recs);
+    return -1;
+  }
+  for (i = 0; i < count; i++) {
+    room = mem_find_room(reservations[i].room_id);
+    res.id = reservations[i].id;
+    res.user_id = reservations[i].user_id;
+    res.start = reservations[i].start;
+    res.end = reservations[i].end;
+    mem_append(room, &res);
+  }
+  next_id += count;
+  *order = ++committed;
+  pthread_rwlock_unlock(&memlock);
+  free(recs);
+  if (seq)
+    unsynced = seq;
+  return 0;
+}
+
+
+/* A removal is journaled as one batch before any of it is made */
+static ssize_t mem_remove(int roomid, time_t start, time_t end, int user_id,
+                          reservation_t **removed, uint64_t *order)
+{
+  mroom_t *room;
+  mres_t res;
+  size_t count;
+  size_t i, j;
+  jrec_t *recs;
+  uint64_t seq;
+
+  *removed = NULL;
+  *order = 0;
+  count = 0;
+  seq = 0;
+  pthread_rwlock_wrlock(&memlock);
+  if (!(room = mem_find_room(roomid))) {
+    pthread_rwlock_unlock(&memlock);
+    return 0;
+  }
+  for (i = 0; i < room->count; i++) {
+    mem_get(room, i, &res);
+    if (res.start <= start && res.end >= end &&
+        (user_id < 0 || res.user_id == user_id)) {
+      *removed = realloc(*removed, (count+1) * sizeof(reservation_t));
+      mem_fill(*removed+count, room, &res);
+      count++;
+    }
+  }
+  if (journaled && count) {
+    recs = calloc(count, sizeof(jrec_t));
+    for (i = 0; i < count; i++) {
+      recs[i].op = JOURNAL_REMOVE;
+      recs[i].room_id = roomid;
+      recs[i].id = (*removed)[i].id;
+      recs[i].user_id = (*removed)[i].user_id;
+      recs[i].start = (*removed)[i].start;
+      recs[i].end = (*removed)[i].end;
+    }
+    seq = journal_append_batch(recs, count);
+    free(recs);
+    if (!seq) {
+      pthread_rwlock_unlock(&memlock);
+      free(*removed);
+      *removed = NULL;
+      return -1;
+    }
+  }
+  if (count) {
+    mem_own(room);
+    for (i = j = 0; i < room->count; i++) {
+      mem_get(room, i, &res);
+      if (!(res.start <= start && res.end >= end &&
+            (user_id < 0 || res.user_id == user_id)))
+        mem_set(room, j++, &res);
+    }
+    room->count = j;
+    *order = ++committed;
+  }
+  pthread_rwlock_unlock(&memlock);
+  if (seq)
+    unsynced = seq;
+  return count;
+}
+
+
+/* Only the reservations starting at `start` need looking at */
+static int mem_remove_id(const reservation_t *reservation, uint64_t *order)
+{
+  mroom_t *room;
+  jrec_t rec;
+  uint64_t seq;
+  size_t i;
+
+  seq = 0;
+  *order = 0;
+  pthread_rwlock_wrlock(&memlock);
+  if (!(room = mem_find_room(reservation->room_id))) {
+    pthread_rwlock_unlock(&memlock);
+    return 1;
+  }
+  for (i = mem_upper(room, reservation->start);
+       i > 0 && room->start[i-1] == reservation->start; i--)
+    if (room->id[i-1] == reservation->id)
+      break;
+  if (i == 0 || room->start[i-1] != reservation->start) {
+    pthread_rwlock_unlock(&memlock);
+    return 1;
+  }
+  if (journaled) {
+    memset(&rec, 0, sizeof(jrec_t));
+    rec.op = JOURNAL_REMOVE;
+    rec.room_id = room->room.id;
+    rec.id = room->id[i-1];
+    rec.user_id = room->user[i-1];
+    rec.start = room->start[i-1];
+    rec.end = room->end[i-1];
+    if (!(seq = journal_append(&rec))) {
+      pthread_rwlock_unlock(&memlock);
+      return -1;
+    }
+  }
+  mem_own(room);
+  mem_delete(room, i-1);
+  *order = ++committed;
+  pthread_rwlock_unlock(&memlock);
+  if (seq)
+    unsynced = seq;
+  return 0;
+}
+
+
+/* The write is acknowledged once its journal batch is on disk; waiting is
+ * left to the caller so it can first let other writers go ahead */
+static int mem_sync(void)
+{
+  int status = 0;
+
+  if (unsynced)
+    status = journal_wait(unsynced);
+  unsynced = 0;
+  return status;
+}
+
+
+static ssize_t mem_archive(time_t before)
+{
+  jrec_t rec;
+  uint64_t seq;
+  size_t count;
+  size_t i;
+
+  count = 0;
+  seq = 0;
+  pthread_rwlock_wrlock(&memlock);
+  for (i = 0; i < room_c; i++)
+    count += mem_archive_room(rooms+i, before);
+  if (journaled && count) {
+    memset(&rec, 0, sizeof(jrec_t));
+    rec.op = JOURNAL_ARCHIVE;
+    rec.start = before;
+    seq = journal_append(&rec);
+  }
+  pthread_rwlock_unlock(&memlock);
+  // archiving changes nothing a client sees, so a failed journal (already
+  // logged) only means it is done again after a restart
+  if (seq)
+    journal_wait(seq);
+  return count;
+}
+
+
+static ssize_t mem_history_room(int id, reservation_t **reservations)
+{
+  mroom_t *room;
+  mres_t res;
+  size_t count;
+  size_t i;
+
+  *reservations = NULL;
+  pthread_rwlock_rdlock(&memlock);
+  if (!(room = mem_find_room(id))) {
+    pthread_rwlock_unlock(&memlock);
+    return 0;
+  }
+  count = room->hist_c + room->hwide_c;
+  if (count)
+    *reservations = malloc(count * sizeof(reservation_t));
+  for (i = 0; i < count; i++) {
+    mem_hist_get(room, i, &res);
+    mem_fill(*reservations+i, room, &res);
+  }
+  pthread_rwlock_unlock(&memlock);
+  qsort(*reservations, count, sizeof(reservation_t), compar_reservation);
+  return count;
+}
+
+
+static ssize_t mem_history_user(int user, reservation_t **reservations)
+{
+  mres_t res;
+  size_t count, cap;
+  size_t i, j;
+
+  *reservations = NULL;
+  count = cap = 0;
+  pthread_rwlock_rdlock(&memlock);
+  for (i = 0; i < room_c; i++)
+    for (j = 0; j < rooms[i].hist_c + rooms[i].hwide_c; j++) {
+      mem_hist_get(rooms+i, j, &res);
+      if (res.user_id != user)
+        continue;
+      if (count == cap) {
+        cap = cap ? cap * 2 : 64;
+        *reservations = realloc(*reservations, cap * sizeof(reservation_t));
+      }
+      mem_fill(*reservations + count++, rooms+i, &res);
+    }
+  pthread_rwlock_unlock(&memlock);
+  qsort(*reservations, count, sizeof(reservation_t), compar_reservation);
+  return count;
+}
+
+
+/* Each room is copied out under the lock and written without it, so
+ * writers only ever wait for a single room's copy. */
+/* A room's reservations as lent to an export by `mem_lend` */
+typedef struct mlent_s {
+  room_t room;
+  int64_t *start;
+  int64_t *end;
+  int32_t *id;
+  int32_t *user;
+  size_t count;
+  size_t cap;           /* non-zero if the room owned the arrays */
+} mlent_t;
+
+/* Where an exported reservation is among the lent rooms */
+typedef struct mrow_s {
+  int32_t id;
+  uint32_t room;
+  uint32_t at;
+} mrow_t;
+
+static int compar_row(const void *a, const void *b)
+{
+  const mrow_t *x = a, *y = b;
+  return (x->id > y->id) - (x->id < y->id);
+}
+
+// a room lent to one export could be handed back while another reads it
+static pthread_mutex_t exportlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Lends every room's reservations as they are now, without copying them:
+ * the rooms are marked as borrowing their own arrays, so the next change
+ * to one copies it first, as for arrays mapped from a snapshot */
+static mlent_t *mem_lend(size_t *count)
+{
+  mlent_t *lent;
+  size_t i;
+
+  pthread_rwlock_wrlock(&memlock);
+  lent = malloc((room_c ? room_c : 1) * sizeof(mlent_t));
+  for (i = 0; i < room_c; i++) {
+    lent[i].room = rooms[i].room;
+    lent[i].start = rooms[i].start;
+    lent[i].end = rooms[i].end;
+    lent[i].id = rooms[i].id;
+    lent[i].user = rooms[i].user;
+    lent[i].count = rooms[i].count;
+    lent[i].cap = rooms[i].cap;
+    rooms[i].cap = 0;
+  }
+  *count = room_c;
+  pthread_rwlock_unlock(&memlock);
+  return lent;
+}
+
+/* Gives the rooms that were not changed meanwhile their arrays back, and
+ * frees those that were copied away from */
+static void mem_return(mlent_t *lent, size_t count)
+{
+  size_t i;
+
+  pthread_rwlock_wrlock(&memlock);
+  for (i = 0; i < count; i++) {
+    if (!lent[i].cap)
+      continue;
+    if (rooms[i].cap == 0 && rooms[i].start == lent[i].start) {
+      rooms[i].cap = lent[i].cap;
+      continue;
+    }
+    free(lent[i].start);
+    free(lent[i].end);
+    free(lent[i].id);
+    free(lent[i].user);
+  }
+  pthread_rwlock_unlock(&memlock);
+  free(lent);
+}
+
+/* Rows come out in order of id, as from SQLite; the users and the rooms
+ * themselves only change on loading */
+static int mem_export(int fd, int format)
+{
+  exportbuf_t *eb;
+  reservation_t reservation;
+  mlent_t *lent, *room;
+  mrow_t *rows;
+  size_t lent_c, row_c;
+  user_t *user;
+  size_t i, j;
+
+  pthread_mutex_lock(&exportlock);
+  lent = mem_lend(&lent_c);
+  for (row_c = i = 0; i < lent_c; i++)
+    row_c += lent[i].count;
+  rows = malloc((row_c ? row_c : 1) * sizeof(mrow_t));
+  for (row_c = i = 0; i < lent_c; i++) {
+    for (j = 0; j < lent[i].count; j++, row_c++) {
+      rows[row_c].id = lent[i].id[j];
+      rows[row_c].room = i;
+      rows[row_c].at = j;
+    }
+  }
+  qsort(rows, row_c, sizeof(mrow_t), compar_row);
+  eb = export_open(fd, format);
+  for (i = 0; i < row_c; i++) {
+    room = lent + rows[i].room;
+    j = rows[i].at;
+    reservation.next = NULL;
+    reservation.id = room->id[j];
+    reservation.room_id = room->room.id;
+    reservation.user_id = room->user[j];
+    reservation.start = room->start[j];
+    reservation.end = room->end[j];
+    user = mem_find_user(reservation.user_id);
+    export_row(eb, reservation.id, &reservation, user, &room->room);
+  }
+  free(rows);
+  mem_return(lent, lent_c);
+  pthread_mutex_unlock(&exportlock);
+  return export_close(eb);
+}
+
+
+const backend_t backend_memory = {
+  .name = "memory",
+  .load = mem_load,
+  .user = mem_user,
+  .room = mem_room,
+  .rooms = mem_rooms,
+  .reservations_room = mem_reservations_room,
+  .page_room = mem_page_room,
+  .reserve = mem_reserve,
+  .remove = mem_remove,
+  .remove_id = mem_remove_id,
+  .sync = mem_sync,
+  .export = mem_export,
+  .archive = mem_archive,
+  .history_room = mem_history_room,
+  .history_user = mem_history_user
+};
+
+const backend_t backend_journal = {
+  .name = "journal",
+  .load = jnl_load,
+  .user = mem_user,
+  .room = mem_room,
+  .rooms = mem_rooms,
+  .reservations_room = mem_reservations_room,
+  .page_room = mem_page_room,
+  .reserve = mem_reserve,
+  .remove = mem_remove,
+  .remove_id = mem_remove_id,
+  .sync = mem_sync,
+  .export = mem_export,
+  .archive = mem_archive,
+  .history_room = mem_history_room,
+  .history_user = mem_history_user
+};
@@ -0,0 +1,698 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "export.h"
+#include "sqlite3.h"
+
+
+/* How long a connection waits on another's write lock, in milliseconds */
+#ifndef SQL_BUSY_TIMEOUT
+#define SQL_BUSY_TIMEOUT 5000
+#endif
+
+/* The first wait for another connection's lock, in microseconds */
+#ifndef SQL_BUSY_DELAY
+#define SQL_BUSY_DELAY 50
+#endif
+
+/* How many times a reservation transaction is retried when still busy */
+#ifndef SQL_RETRIES
+#define SQL_RETRIES 8
+#endif
+
+
+/* Every thread has its own connection: readers never wait on each other and
+ * SQLite itself serializes the writers, so no lock is needed here */
+static __thread sqlite3 *db = NULL;
+static pthread_key_t dbkey;
+static char *db_path = NULL;
+/* The number of the last change made, see `backend_t` */
+static uint64_t committed = 0;
+
+
+static int dbfail()
+{
+  syslog(LOG_ERR, "%s", sqlite3_errmsg(db));
+  return -1;
+}
+
+/* Numbers a change; taken inside its write transaction, which SQLite
+ * serializes, so the numbers follow the order of the commits */
+static uint64_t sql_order(void)
+{
+  return __atomic_add_fetch(&committed, 1, __ATOMIC_RELAXED);
+}
+
+
+/* SQLite's own busy handler sleeps for milliseconds at a time, which leaves
+ * the write lock idle between short transactions; back off from
+ * SQL_BUSY_DELAY microseconds instead, doubling up to 32 times that */
+static int sql_busy(void *_, int tries)
+{
+  useconds_t delay = SQL_BUSY_DELAY << (tries < 5 ? tries : 5);
+
+  if ((long)tries * delay > SQL_BUSY_TIMEOUT * 1000L)
+    return 0;
+  usleep(delay);
+  return 1;
+}
+
+static void sql_disconnect(void *conn)
+{
+  sqlite3_close(conn);
+}
+
+/* Opens the calling thread's connection if it has none yet */
+static int sql_connect(void)
+{
+  if (db)
+    return 0;
+  if (!db_path)
+    return -1;
+  if (SQLITE_OK != sqlite3_open(db_path, &db)) {
+    dbfail();
+    sqlite3_close(db);
+    db = NULL;
+    return -1;
+  }
+  sqlite3_busy_handler(db, sql_busy, NULL);
+  pthread_setspecific(dbkey, db);
+  return 0;
+}
+
+
+static int sql_exec_quiet(const char *sql)
+{
+  sqlite3_stmt *stmt;
+  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
+                                   &stmt, NULL))
+    return 1;
+  if (SQLITE_DONE != sqlite3_step(stmt)) {
+    sqlite3_finalize(stmt);
+    return 1;
+  }
+  sqlite3_finalize(stmt);
+  return 0;
+}
+
+static void sql_room_row(sqlite3_stmt *stmt, room_t *room)
+{
+  room->id = sqlite3_column_int(stmt, 0);
+  room->size = sqlite3_column_int(stmt, 1);
+  room->sqft = sqlite3_column_int(stmt, 2);
+  room->capacity = sqlite3_column_int(stmt, 3);
+  if (sqlite3_column_text(stmt, 4) != NULL)
+    strncpy(room->note, (const char*)sqlite3_column_text(stmt, 4), 63);
+  else
+    room->note[0] = 0;
+}
+
+static void sql_reservation_row(sqlite3_stmt *stmt,
+                                reservation_t *reservation)
+{
+  reservation->id = sqlite3_column_int(stmt, 0);
+  reservation->room_id = sqlite3_column_int(stmt, 1);
+  reservation->user_id = sqlite3_column_int(stmt, 2);
+  reservation->start = (time_t)sqlite3_column_int64(stmt, 3);
+  reservation->end = (time_t)sqlite3_column_int64(stmt, 4);
+  reservation->next = NULL;
+}
+
+static ssize_t sql_reservations(const char *sql_count, const char *sql_select,
+                                reservation_t *reservations)
+{
+  sqlite3_stmt *stmt;
+  const char *sql;
+  size_t count;
+  int status;
+
+  sql = reservations ? sql_select : sql_count;
+  if (0 != sql_connect())
+    return -1;
+  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
+                                   &stmt, NULL))
+    goto failure;
+  if (!reservations) {
+    if (SQLITE_ROW != sqlite3_step(stmt))
+      goto failure;
+    count = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return count;
+  }
+  count = 0;
+  while (SQLITE_ROW == (status = sqlite3_step(stmt)))
+    sql_reservation_row(stmt, reservations + count++);
+  if (SQLITE_DONE != status)
+    goto failure;
+  sqlite3_finalize(stmt);
+  return count;
+ failure:
+  status = dbfail();
+  sqlite3_finalize(stmt);
+  return status;
+}
+
+/* As `sql_reservations`, into an array grown as the rows are read; a
+ * single statement reads them all from one snapshot of the database */
+static ssize_t sql_reservations_all(const char *sql_select,
+                                    reservation_t **reservations)
+{
+  sqlite3_stmt *stmt;
+  size_t count, cap;
+  int status;
+
+  *reservations = NULL;
+  if (0 != sql_connect())
+    return -1;
+  if (SQLITE_OK != sqlite3_prepare(db, sql_select, strlen(sql_select),
+                                   &stmt, NULL))
+    goto failure;
+  count = cap = 0;
+  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
+    if (count == cap) {
+      cap = cap ? cap * 2 : 64;
+      *reservations = realloc(*reservations, cap * sizeof(reservation_t));
+    }
+    sql_reservation_row(stmt, *reservations + count++);
+  }
+  if (SQLITE_DONE != status)
+    goto failure;
+  sqlite3_finalize(stmt);
+  return count;
+ failure:
+  status = dbfail();
+  sqlite3_finalize(stmt);
+  free(*reservations);
+  *reservations = NULL;
+  return status;
+}
+
+
+static int sql_load(const char *dbpath)
+{
+  int status;
+
+  free(db_path);
+  db_path = strdup(dbpath);
+  if (0 != pthread_key_create(&dbkey, sql_disconnect) || 0 != sql_connect())
+    return -1;
+  // readers get their own snapshot and never block the writer
+  sqlite3_exec(db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+  // ensure the proper tables exist
+  status = 0;
+  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS user ("
+                           "id INTEGER PRIMARY KEY,"
+                           "status INTEGER NOT NULL,"
+                           "email TEXT NOT NULL)");
+  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS room ("
+                           "id INTEGER PRIMARY KEY,"
+                           "size INTEGER NOT NULL,"
+                           "sqft INTEGER NOT NULL,"
+                           "capacity INTEGER NOT NULL,"
+                           "note TEXT)");
+  // bumped on any change to the rooms, so a copy of them can be checked
+  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS room_version ("
+                           "version INTEGER NOT NULL)");
+  status |= sql_exec_quiet("INSERT INTO room_version SELECT 0 WHERE NOT EXISTS "
+                           "(SELECT * FROM room_version)");
+  status |= sql_exec_quiet("CREATE TRIGGER IF NOT EXISTS room_inserted "
+                           "AFTER INSERT ON room BEGIN "
+                           "UPDATE room_version SET version=version+1; END");
+  status |= sql_exec_quiet("CREATE TRIGGER IF NOT EXISTS room_updated "
+                           "AFTER UPDATE ON room BEGIN "
+                           "UPDATE room_version SET version=version+1; END");
+  status |= sql_exec_quiet("CREATE TRIGGER IF NOT EXISTS room_deleted "
+                           "AFTER DELETE ON room BEGIN "
+                           "UPDATE room_version SET version=version+1; END");
+  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS reservation ("
+                           "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                           "room_id INTEGER NOT NULL,"
+                           "user_id INTEGER NOT NULL,"
+                           "start_time INTEGER NOT NULL,"
+                           "end_time INTEGER NOT NULL)");
+  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS reservation_history ("
+                           "id INTEGER PRIMARY KEY,"
+                           "room_id INTEGER NOT NULL,"
+                           "user_id INTEGER NOT NULL,"
+                           "start_time INTEGER NOT NULL,"
+                           "end_time INTEGER NOT NULL)");
+  status |= sql_exec_quiet("CREATE INDEX IF NOT EXISTS reservation_end "
+                           "ON reservation (end_time)");
+  status |= sql_exec_quiet("CREATE INDEX IF NOT EXISTS reservation_room "
+                           "ON reservation (room_id, start_time)");
+  status |= sql_exec_quiet("CREATE INDEX IF NOT EXISTS "
+                           "reservation_history_room "
+                           "ON reservation_history (room_id, start_time)");
+  status |= sql_exec_quiet("CREATE INDEX IF NOT EXISTS "
+                           "reservation_history_user "
+                           "ON reservation_history (user_id, start_time)");
+  if (status != 0)
+    return dbfail();
+  // OK
+  return 0;
+}
+
+
+static int sql_user(int id, user_t *user)
+{
+  char sql[128];
+  sqlite3_stmt *stmt;
+  int status;
+
+  if (0 != sql_connect())
+    return -1;
+  sprintf(sql, "SELECT * FROM user WHERE (id=%d)", id);
+  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
+                                   &stmt, NULL))
+    return dbfail();
+  status = 1;
+  switch(sqlite3_step(stmt)) {
+  case SQLITE_ROW:
+    user->id = sqlite3_column_int(stmt, 0);
+    user->status = sqlite3_column_int(stmt, 1);
+    strncpy(user->email, (const char*)sqlite3_column_text(stmt, 2), 63);
+    status = 0;
+  case SQLITE_DONE:
+    sqlite3_finalize(stmt);
+    break;
+  case SQLITE_ERROR:
+    dbfail();
+    break;
+  default:
+    syslog(LOG_ERR, "The SQLITE API is broken");
+  }
+  return status;
+}
+
+
+static int sql_room(int id, room_t *room)
+{
+  char sql[128];
+  sqlite3_stmt *stmt;
+  int status;
+
+  if (0 != sql_connect())
+    return -1;
+  sprintf(sql, "SELECT * FROM room WHERE id=%d", id);
+  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
+                                   &stmt, NULL))
+    return dbfail();
+  status = 1;
+  switch(sqlite3_step(stmt)) {
+  case SQLITE_ROW:
+    sql_room_row(stmt, room);
+    status = 0;
+  case SQLITE_DONE:
+    sqlite3_finalize(stmt);
+    break;
+  case SQLITE_ERROR:
+    dbfail();
+    break;
+  default:
+    syslog(LOG_ERR, "The SQLITE API is broken");
+  }
+  return status;
+}
+
+
+static ssize_t sql_rooms(room_t *rooms)
+{
+  const char sql_count[] = "SELECT COUNT(*) FROM room";
+  const char sql_select[] = "SELECT * FROM room ORDER BY id ASC";
+  sqlite3_stmt *stmt;
+  size_t count;
+  int status;
+
+  if (0 != sql_connect())
+    return -1;
+  if (!rooms) {
+    if (SQLITE_OK != sqlite3_prepare(db, sql_count,
+                                     strlen(sql_count) * sizeof(char),
+                                     &stmt, NULL))
+      return dbfail();
+    if (SQLITE_ROW != sqlite3_step(stmt))
+      return dbfail();
+    count = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    return count;
+  }
+  if (SQLITE_OK != sqlite3_prepare(db, sql_select,
+                                   strlen(sql_select) * sizeof(char),
+                                   &stmt, NULL))
+    return dbfail();
+  count = 0;
+  while (SQLITE_ROW == (status = sqlite3_step(stmt)))
+    sql_room_row(stmt, rooms + count++);
+  if (SQLITE_DONE != status)
+    return dbfail();
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+
+static long sql_rooms_version(void)
+{
+  const char sql[] = "SELECT version FROM room_version";
+  sqlite3_stmt *stmt;
+  long version;
+
+  if (0 != sql_connect())
+    return -1;
+  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
+                                   &stmt, NULL))
+    return dbfail();
+  version = (SQLITE_ROW == sqlite3_step(stmt)) ?
+    (long)sqlite3_column_int64(stmt, 0) : -1;
+  sqlite3_finalize(stmt);
+  return version;
+}
+
+
+static ssize_t sql_reservations_room(int room, reservation_t *reservations)
+{
+  char sql_count[128];
+  char sql_select[128];
+
+  sprintf(sql_count, "SELECT COUNT(*) FROM reservation WHERE room_id=%d",
+          room);
+  sprintf(sql_select, "SELECT * FROM reservation WHERE room_id=%d "
+          "ORDER BY start_time ASC", room);
+  return sql_reservations(sql_count, sql_select, reservations);
+}
+
+
+/* The key is spelled out so the (room_id, start_time) index, which ends in
+ * the id, is walked from where the last page stopped */
+static ssize_t sql_page_room(int room, const reservation_t *after,
+                             reservation_t *reservations, size_t max)
+{
+  char sql_select[256];
+
+  if (after)
+    sprintf(sql_select, "SELECT * FROM reservation WHERE room_id=%d AND "
+            "start_time>=%ld AND (start_time>%ld OR id>%d) "
+            "ORDER BY start_time ASC, id ASC LIMIT %lu", room,
+            (long)after->start, (long)after->start, after->id,
+            (unsigned long)max);
+  else
+    sprintf(sql_select, "SELECT * FROM reservation WHERE room_id=%d "
+            "ORDER BY start_time ASC, id ASC LIMIT %lu", room,
+            (unsigned long)max);
+  return sql_reservations(NULL, sql_select, reservations);
+}
+
+
+/* Inserts each reservation only if its room exists and nothing in it
+ * overlaps; the room's (room_id, start_time) index bounds the search.
+ * Returns SQLITE_CONSTRAINT if one was refused, otherwise the result of the
+ * transaction. */
+static int sql_try_reserve(reservation_t *reservations, size_t count,
+                           uint64_t *order)
+{
+  const char sql[] = "INSERT INTO reservation "
+    "(room_id,user_id,start_time,end_time) SELECT ?1,?2,?3,?4 "
+    "WHERE EXISTS (SELECT 1 FROM room WHERE id=?1) "
+    "AND NOT EXISTS (SELECT 1 FROM reservation WHERE room_id=?1 "
+    "AND start_time<?4 AND end_time>?3)";
+  sqlite3_stmt *stmt;
+  size_t i;
+  int status;
+
+  if (SQLITE_OK != (status = sqlite3_exec(db, "BEGIN IMMEDIATE",
+                                          NULL, NULL, NULL)))
+    return status;
+  if (SQLITE_OK != (status = sqlite3_prepare_v2(db, sql, sizeof(sql),
+                                                &stmt, NULL))) {
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    return status;
+  }
+  for (i = 0; i < count; i++) {
+    sqlite3_bind_int(stmt, 1, reservations[i].room_id);
+    sqlite3_bind_int(stmt, 2, reservations[i].user_id);
+    sqlite3_bind_int64(stmt, 3, reservations[i].start);
+    sqlite3_bind_int64(stmt, 4, reservations[i].end);
+    if (SQLITE_DONE != (status = sqlite3_step(stmt)))
+      break;
+    status = sqlite3_changes(db) == 1 ? SQLITE_OK : SQLITE_CONSTRAINT;
+    if (status != SQLITE_OK)
+      break;
+    reservations[i].id = sqlite3_last_insert_rowid(db);
+    sqlite3_reset(stmt);
+  }
+  sqlite3_finalize(stmt);
+  if (status == SQLITE_OK) {
+    *order = sql_order();
+    status = sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+  }
+  if (status != SQLITE_OK)
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+  return status;
+}
+
+static int sql_reserve(reservation_t *reservations, size_t count,
+                       uint64_t *order)
+{
+  int attempt;
+  int status;
+
+  *order = 0;
+  if (0 != sql_connect())
+    return -1;
+  // the busy timeout covers waiting for the write lock; a transaction
+  // that still comes back busy is simply run again, unless it already
+  // took a number, which then has to be reported
+  for (attempt = 0; attempt < SQL_RETRIES; attempt++) {
+    status = sql_try_reserve(reservations, count, order);
+    if ((status & 0xff) != SQLITE_BUSY || *order)
+      break;
+    usleep(1000 << attempt);
+  }
+  if (status == SQLITE_OK)
+    return 0;
+  if (status == SQLITE_CONSTRAINT)
+    return 1;
+  return dbfail();
+}
+
+
+static ssize_t sql_remove(int roomid, time_t start, time_t end, int user_id,
+                          reservation_t **removed, uint64_t *order)
+{
+  char sql[256];
+  sqlite3_stmt *stmt;
+  int status;
+  size_t count;
+  size_t cap;
+
+  sprintf(sql, "SELECT id, room_id, user_id, start_time, end_time "
+          "FROM reservation WHERE "
+          "room_id=%d AND start_time<=%ld AND end_time>=%ld",
+          roomid, start, end);
+  if (user_id >= 0)
+    sprintf(sql+strlen(sql), " AND user_id=%d", user_id);
+  *order = 0;
+  if (0 != sql_connect())
+    return -1;
+  // the rows are read and deleted under one write transaction
+  if (SQLITE_OK != sqlite3_exec(db, "BEGIN IMMEDIATE", NULL, NULL, NULL))
+    return dbfail();
+  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
+                                   &stmt, NULL)) {
+    dbfail();
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    return -1;
+  }
+  *removed = NULL;
+  count = cap = 0;
+  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
+    if (count == cap) {
+      cap = cap ? cap * 2 : 4;
+      *removed = realloc(*removed, cap * sizeof(reservation_t));
+    }
+    (*removed)[count].next = NULL;
+    (*removed)[count].id = sqlite3_column_int(stmt, 0);
+    (*removed)[count].room_id = sqlite3_column_int(stmt, 1);
+    (*removed)[count].user_id = sqlite3_column_int(stmt, 2);
+    (*removed)[count].start = (time_t)sqlite3_column_int64(stmt, 3);
+    (*removed)[count].end = (time_t)sqlite3_column_int64(stmt, 4);
+    sprintf(sql, "DELETE FROM reservation WHERE id=%d",
+            sqlite3_column_int(stmt, 0));
+    sqlite3_exec(db, sql, NULL, NULL, NULL);
+    count++;
+  }
+  sqlite3_finalize(stmt);
+  if (SQLITE_DONE == status)
+    *order = sql_order();
+  if (SQLITE_DONE != status ||
+      SQLITE_OK != sqlite3_exec(db, "COMMIT", NULL, NULL, NULL)) {
+    dbfail();
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    free(*removed);
+    *removed = NULL;
+    return -1;
+  }
+  return count;
+}
+
+
+static int sql_remove_id(const reservation_t *reservation, uint64_t *order)
+{
+  char sql[64];
+
+  *order = 0;
+  if (0 != sql_connect())
+    return -1;
+  // a transaction of its own, so the number is taken before the commit
+  if (0 != sql_exec_quiet("BEGIN IMMEDIATE"))
+    return dbfail();
+  sprintf(sql, "DELETE FROM reservation WHERE id=%d", reservation->id);
+  if (0 != sql_exec_quiet(sql)) {
+    dbfail();
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    return -1;
+  }
+  if (!sqlite3_changes(db)) {
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    return 1;
+  }
+  *order = sql_order();
+  if (0 != sql_exec_quiet("COMMIT")) {
+    dbfail();
+    sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    return -1;
+  }
+  return 0;
+}
+
+
+static int sql_export(int fd, int format)
+{
+  const char sql[] = "SELECT reservation.id, reservation.room_id, "
+    "reservation.user_id, reservation.start_time, reservation.end_time, "
+    "user.id, user.email, room.id, room.capacity, room.sqft, room.note "
+    "FROM reservation "
+    "LEFT JOIN user ON user.id=reservation.user_id "
+    "LEFT JOIN room ON room.id=reservation.room_id "
+    "ORDER BY reservation.id ASC";
+  sqlite3 *edb;
+  sqlite3_stmt *stmt;
+  exportbuf_t *eb;
+  reservation_t reservation;
+  user_t user;
+  room_t room;
+  int status;
+
+  if (!db_path)
+    return -1;
+  // a separate read-only connection holds its own snapshot for the export
+  if (SQLITE_OK != sqlite3_open_v2(db_path, &edb, SQLITE_OPEN_READONLY, NULL)) {
+    syslog(LOG_ERR, "%s", sqlite3_errmsg(edb));
+    sqlite3_close(edb);
+    return -1;
+  }
+  if (SQLITE_OK != sqlite3_exec(edb, "BEGIN", NULL, NULL, NULL) ||
+      SQLITE_OK != sqlite3_prepare_v2(edb, sql, sizeof(sql), &stmt, NULL)) {
+    syslog(LOG_ERR, "%s", sqlite3_errmsg(edb));
+    sqlite3_close(edb);
+    return -1;
+  }
+  memset(&user, 0, sizeof(user_t));
+  memset(&room, 0, sizeof(room_t));
+  reservation.next = NULL;
+  eb = export_open(fd, format);
+  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
+    reservation.id = sqlite3_column_int(stmt, 0);
+    reservation.room_id = sqlite3_column_int(stmt, 1);
+    reservation.user_id = sqlite3_column_int(stmt, 2);
+    reservation.start = (time_t)sqlite3_column_int64(stmt, 3);
+    reservation.end = (time_t)sqlite3_column_int64(stmt, 4);
+    user.id = reservation.user_id;
+    if (sqlite3_column_text(stmt, 6) != NULL)
+      strncpy(user.email, (const char*)sqlite3_column_text(stmt, 6), 63);
+    room.id = reservation.room_id;
+    room.capacity = sqlite3_column_int(stmt, 8);
+    room.sqft = sqlite3_column_int(stmt, 9);
+    if (sqlite3_column_text(stmt, 10) != NULL)
+      strncpy(room.note, (const char*)sqlite3_column_text(stmt, 10), 63);
+    else
+      room.note[0] = 0;
+    export_row(eb, sqlite3_column_int64(stmt, 0), &reservation,
+               sqlite3_column_type(stmt, 5) == SQLITE_NULL ? NULL : &user,
+               sqlite3_column_type(stmt, 7) == SQLITE_NULL ? NULL : &room);
+  }
+  if (SQLITE_DONE != status)
+    syslog(LOG_ERR, "%s", sqlite3_errmsg(edb));
+  status = (export_close(eb) == 0 && SQLITE_DONE == status) ? 0 : -1;
+  sqlite3_finalize(stmt);
+  sqlite3_exec(edb, "COMMIT", NULL, NULL, NULL);
+  sqlite3_close(edb);
+  return status;
+}
+
+
+static ssize_t sql_archive(time_t before)
+{
+  char sql[128];
+  ssize_t count;
+
+  if (0 != sql_connect() || 0 != sql_exec_quiet("BEGIN IMMEDIATE"))
+    goto failure;
+  sprintf(sql, "INSERT INTO reservation_history "
+          "SELECT * FROM reservation WHERE end_time<%ld", before);
+  if (0 != sql_exec_quiet(sql))
+    goto rollback;
+  count = sqlite3_changes(db);
+  sprintf(sql, "DELETE FROM reservation WHERE end_time<%ld", before);
+  if (0 != sql_exec_quiet(sql) || 0 != sql_exec_quiet("COMMIT"))
+    goto rollback;
+  return count;
+ rollback:
+  syslog(LOG_ERR, "%s", sqlite3_errmsg(db));
+  sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+ failure:
+  return -1;
+}
+
+
+static ssize_t sql_history_room(int room, reservation_t **reservations)
+{
+  char sql_select[128];
+
+  sprintf(sql_select, "SELECT * FROM reservation_history WHERE room_id=%d "
+          "ORDER BY start_time ASC", room);
+  return sql_reservations_all(sql_select, reservations);
+}
+
+
+static ssize_t sql_history_user(int user, reservation_t **reservations)
+{
+  char sql_select[128];
+
+  sprintf(sql_select, "SELECT * FROM reservation_history WHERE user_id=%d "
+          "ORDER BY start_time ASC", user);
+  return sql_reservations_all(sql_select, reservations);
+}
+
+
+const backend_t backend_sqlite = {
+  .name = "sqlite",
+  .load = sql_load,
+  .user = sql_user,
+  .room = sql_room,
+  .rooms = sql_rooms,
+  .rooms_version = sql_rooms_version,
+  .reservations_room = sql_reservations_room,
+  .page_room = sql_page_room,
+  .reserve = sql_reserve,
+  .remove = sql_remove,
+  .remove_id = sql_remove_id,
+  .export = sql_export,
+  .archive = sql_archive,
+  .history_room = sql_history_room,
+  .history_user = sql_history_user
+};
@@ -18,11 +18,15 @@ int email_send(const char *address, const char *body)
   memset(&ssocket, 0, sizeof(struct sockaddr_in));
   ssocket.sin_family = AF_INET;
   ssocket.sin_port = htons(EMAIL_SERVER_PORT);
-  if (1 != inet_pton(AF_INET, EMAIL_SERVER_ADDR, &ssocket.sin_addr))
+  if (1 != inet_pton(AF_INET, EMAIL_SERVER_ADDR, &ssocket.sin_addr)) {
+    close(fd);
     return -1;
+  }
   assert(0 == setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &truth, sizeof(int)));
-  if (0 != connect(fd, (struct sockaddr *)&ssocket, sizeof(ssocket)))
+  if (0 != connect(fd, (struct sockaddr *)&ssocket, sizeof(ssocket))) {
+    close(fd);
     return -1;
+  }
 
   char *message = malloc((16 + strlen(address) + strlen(body)) * sizeof(char));
   sprintf(message, "HELO localhost\r\n");
@@ -37,6 +41,7 @@ int email_send(const char *address, const char *body)
   assert(0 <= send(fd, message, strlen(message), 0));
   sprintf(message, "QUIT\r\n");
   assert(0 <= send(fd, message, strlen(message), 0));
+  free(message);
   close(fd);
   return 0;
 }
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "export.h"
+
+
+/* Exports are written through a large private buffer straight to a file
+ * descriptor so memory use stays constant regardless of table size. */
+#define EXPORT_BUFSIZE (1 << 20)
+
+struct exportbuf_s {
+  int fd;
+  int format;
+  int status;
+  size_t len;
+  char buf[EXPORT_BUFSIZE];
+};
+
+
+static void export_flush(exportbuf_t *eb)
+{
+  size_t off;
+  ssize_t w;
+
+  for (off = 0; off < eb->len && eb->status == 0; off += w)
+    if (0 > (w = write(eb->fd, eb->buf+off, eb->len-off)))
+      eb->status = -1;
+  eb->len = 0;
+}
+
+static void export_write(exportbuf_t *eb, const char *str, size_t len)
+{
+  size_t n;
+
+  while (len) {
+    if (eb->len == EXPORT_BUFSIZE)
+      export_flush(eb);
+    n = EXPORT_BUFSIZE - eb->len;
+    if (n > len)
+      n = len;
+    memcpy(eb->buf+eb->len, str, n);
+    eb->len += n;
+    str += n;
+    len -= n;
+  }
+}
+
+static void export_str(exportbuf_t *eb, const char *str)
+{ export_write(eb, str, strlen(str)); }
+
+static void export_csv_field(exportbuf_t *eb, const char *str)
+{
+  const char *q;
+
+  if (!str)
+    return;
+  if (!strpbrk(str, ",\"\r\n")) {
+    export_str(eb, str);
+    return;
+  }
+  export_write(eb, "\"", 1);
+  while ((q = strchr(str, '"'))) {
+    export_write(eb, str, q-str+1);
+    export_write(eb, "\"", 1);
+    str = q+1;
+  }
+  export_str(eb, str);
+  export_write(eb, "\"", 1);
+}
+
+static void export_json_string(exportbuf_t *eb, const char *str)
+{
+  char esc[8];
+
+  if (!str) {
+    export_write(eb, "null", 4);
+    return;
+  }
+  export_write(eb, "\"", 1);
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      esc[0] = '\\';
+      esc[1] = *str;
+      export_write(eb, esc, 2);
+    } else if ((unsigned char)*str < 0x20) {
+      sprintf(esc, "\\u%04x", (unsigned char)*str);
+      export_write(eb, esc, 6);
+    } else {
+      export_write(eb, str, 1);
+    }
+  }
+  export_write(eb, "\"", 1);
+}
+
+
+exportbuf_t *export_open(int fd, int format)
+{
+  exportbuf_t *eb;
+
+  eb = malloc(sizeof(exportbuf_t));
+  eb->fd = fd;
+  eb->format = format;
+  eb->status = 0;
+  eb->len = 0;
+  if (format == SCHED_EXPORT_CSV)
+    export_str(eb, "id,room_id,user_id,email,start_time,end_time,"
+               "capacity,sqft,note\n");
+  return eb;
+}
+
+void export_row(exportbuf_t *eb, long long id, const reservation_t *r,
+                const user_t *user, const room_t *room)
+{
+  char line[128];
+
+  if (eb->format == SCHED_EXPORT_CSV) {
+    sprintf(line, "%lld,%d,%d,", id, r->room_id, r->user_id);
+    export_str(eb, line);
+    export_csv_field(eb, user ? user->email : NULL);
+    sprintf(line, ",%lld,%lld,", (long long)r->start, (long long)r->end);
+    export_str(eb, line);
+    if (room) {
+      sprintf(line, "%d,%d,", room->capacity, room->sqft);
+      export_str(eb, line);
+      export_csv_field(eb, room->note[0] ? room->note : NULL);
+    } else {
+      export_str(eb, ",,");
+    }
+    export_write(eb, "\n", 1);
+  } else {
+    sprintf(line, "{\"id\":%lld,\"room_id\":%d,\"user_id\":%d,\"email\":",
+            id, r->room_id, r->user_id);
+    export_str(eb, line);
+    export_json_string(eb, user ? user->email : NULL);
+    sprintf(line, ",\"start_time\":%lld,\"end_time\":%lld,",
+            (long long)r->start, (long long)r->end);
+    export_str(eb, line);
+    if (room) {
+      sprintf(line, "\"capacity\":%d,\"sqft\":%d,\"note\":",
+              room->capacity, room->sqft);
+      export_str(eb, line);
+      export_json_string(eb, room->note[0] ? room->note : NULL);
+    } else {
+      export_str(eb, "\"capacity\":null,\"sqft\":null,\"note\":null");
+    }
+    export_write(eb, "}\n", 2);
+  }
+}
+
+int export_close(exportbuf_t *eb)
+{
+  int status;
+
+  export_flush(eb);
+  status = eb->status;
+  free(eb);
+  return status;
+}
@@ -0,0 +1,31 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include "scheduler.h"
+
+
+typedef struct exportbuf_s exportbuf_t;
+
+
+/**
+ * @brief Begins a buffered export to a file descriptor
+ * The header line (if the format has one) is written immediately.
+ * @param format SCHED_EXPORT_CSV or SCHED_EXPORT_JSON
+ */
+exportbuf_t *export_open(int fd, int format);
+
+/**
+ * @brief Writes one reservation record
+ * The user and room are the rows joined to the reservation and may be NULL
+ * if the reservation refers to a user or room that does not exist.
+ */
+void export_row(exportbuf_t *, long long id, const reservation_t *,
+                const user_t *, const room_t *);
+
+/**
+ * @brief Flushes and frees the export buffer
+ * @return 0 if every write succeeded
+ */
+int export_close(exportbuf_t *);
+
+#endif
@@ -0,0 +1,246 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "feed.h"
+
+
+/* Changes go through one queue to a dispatcher thread, which fans each out
+ * to its room's subscribers.  A subscription is referenced by its room's
+ * list and by the dispatcher while it is being notified, so it can be
+ * cancelled at any time; `release` runs once neither holds it. */
+typedef struct fsub_s {
+  struct fsub_s *next;
+  int refs;
+  int dead;
+  sched_notify_t notify;
+  void (*release)(void *);
+  void *ctx;
+} fsub_t;
+
+typedef struct froom_s {
+  int id;
+  fsub_t *subs;
+} froom_t;
+
+typedef struct fevent_s {
+  struct fevent_s *next;
+  int change;
+  reservation_t reservation;
+} fevent_t;
+
+static froom_t *frooms = NULL;
+static size_t froom_c = 0;
+static size_t froom_cap = 0;
+static fevent_t *head = NULL;
+static fevent_t *tail = NULL;
+static pthread_mutex_t feedlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t feedcond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t feedonce = PTHREAD_ONCE_INIT;
+static pthread_t feed_thread;
+
+
+/* The position of room `id` in `frooms`, or where it would go */
+static size_t feed_room(int id)
+{
+  size_t lo = 0, hi = froom_c, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (frooms[mid].id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static froom_t *feed_find(int id)
+{
+  size_t at = feed_room(id);
+  return (at < froom_c && frooms[at].id == id) ? frooms+at : NULL;
+}
+
+/* Drops a reference; the last one puts the subscription on `freed` */
+static void feed_unref(fsub_t *sub, fsub_t **freed)
+{
+  if (--sub->refs == 0) {
+    sub->next = *freed;
+    *freed = sub;
+  }
+}
+
+/* Takes a subscription out of its room's list */
+static void feed_unlink(froom_t *room, fsub_t *sub, fsub_t **freed)
+{
+  fsub_t **at;
+
+  for (at = &room->subs; *at != sub; at = &(*at)->next);
+  *at = sub->next;
+  sub->dead = 1;
+  feed_unref(sub, freed);
+}
+
+static void feed_free(fsub_t *freed)
+{
+  fsub_t *sub;
+
+  while ((sub = freed)) {
+    freed = sub->next;
+    if (sub->release)
+      sub->release(sub->ctx);
+    free(sub);
+  }
+}
+
+
+static void *feed_main(void *_)
+{
+  fevent_t *event;
+  froom_t *room;
+  fsub_t **grab = NULL;
+  fsub_t *sub;
+  fsub_t *freed;
+  size_t grab_cap = 0;
+  size_t count;
+  size_t i;
+  int *failed = NULL;
+
+  while (1) {
+    pthread_mutex_lock(&feedlock);
+    while (!head)
+      pthread_cond_wait(&feedcond, &feedlock);
+    event = head;
+    if (!(head = event->next))
+      tail = NULL;
+    count = 0;
+    room = feed_find(event->reservation.room_id);
+    for (sub = room ? room->subs : NULL; sub; sub = sub->next) {
+      if (count == grab_cap) {
+        grab_cap = grab_cap ? grab_cap * 2 : 16;
+        grab = realloc(grab, grab_cap * sizeof(fsub_t*));
+        failed = realloc(failed, grab_cap * sizeof(int));
+      }
+      sub->refs++;
+      grab[count++] = sub;
+    }
+    pthread_mutex_unlock(&feedlock);
+    // subscribers are notified without the lock, so they may be slow;
+    // each is checked under it for having been cancelled meanwhile
+    for (i = 0; i < count; i++) {
+      pthread_mutex_lock(&feedlock);
+      failed[i] = grab[i]->dead;
+      pthread_mutex_unlock(&feedlock);
+      if (!failed[i])
+        failed[i] = 0 != grab[i]->notify(grab[i]->ctx, event->change,
+                                         &event->reservation);
+    }
+    freed = NULL;
+    pthread_mutex_lock(&feedlock);
+    for (i = 0; i < count; i++) {
+      if (failed[i] && !grab[i]->dead)
+        feed_unlink(feed_find(event->reservation.room_id), grab[i], &freed);
+      feed_unref(grab[i], &freed);
+    }
+    pthread_mutex_unlock(&feedlock);
+    feed_free(freed);
+    free(event);
+  }
+  return NULL;
+}
+
+static void feed_start(void)
+{
+  if (0 != pthread_create(&feed_thread, NULL, feed_main, NULL) ||
+      0 != pthread_detach(feed_thread))
+    syslog(LOG_ERR, "could not start the change feed");
+}
+
+
+int feed_watch(int room, sched_notify_t notify, void (*release)(void *),
+               void *ctx)
+{
+  froom_t *froom;
+  fsub_t *sub;
+  size_t at;
+
+  pthread_once(&feedonce, feed_start);
+  pthread_mutex_lock(&feedlock);
+  at = feed_room(room);
+  if (at == froom_c || frooms[at].id != room) {
+    if (froom_c == froom_cap) {
+      froom_cap = froom_cap ? froom_cap * 2 : 16;
+      frooms = realloc(frooms, froom_cap * sizeof(froom_t));
+    }
+    memmove(frooms+at+1, frooms+at, (froom_c-at) * sizeof(froom_t));
+    froom_c++;
+    frooms[at].id = room;
+    frooms[at].subs = NULL;
+  }
+  froom = frooms+at;
+  for (sub = froom->subs; sub; sub = sub->next)
+    if (sub->ctx == ctx) {
+      pthread_mutex_unlock(&feedlock);
+      return 1;
+    }
+  sub = malloc(sizeof(fsub_t));
+  sub->refs = 1;
+  sub->dead = 0;
+  sub->notify = notify;
+  sub->release = release;
+  sub->ctx = ctx;
+  sub->next = froom->subs;
+  froom->subs = sub;
+  pthread_mutex_unlock(&feedlock);
+  return 0;
+}
+
+
+int feed_unwatch(int room, const void *ctx)
+{
+  fsub_t *sub, *next;
+  fsub_t *freed = NULL;
+  size_t i;
+  int count = 0;
+
+  pthread_mutex_lock(&feedlock);
+  for (i = 0; i < froom_c; i++) {
+    if (room >= 0 && frooms[i].id != room)
+      continue;
+    for (sub = frooms[i].subs; sub; sub = next) {
+      next = sub->next;
+      if (sub->ctx == ctx) {
+        feed_unlink(frooms+i, sub, &freed);
+        count++;
+      }
+    }
+  }
+  pthread_mutex_unlock(&feedlock);
+  feed_free(freed);
+  return count;
+}
+
+
+void feed_publish(int change, const reservation_t *reservation)
+{
+  froom_t *room;
+  fevent_t *event;
+
+  pthread_mutex_lock(&feedlock);
+  room = feed_find(reservation->room_id);
+  if (room && room->subs) {
+    event = malloc(sizeof(fevent_t));
+    event->next = NULL;
+    event->change = change;
+    event->reservation = *reservation;
+    event->reservation.next = NULL;
+    if (tail)
+      tail->next = event;
+    else
+      head = event;
+    tail = event;
+    pthread_cond_signal(&feedcond);
+  }
+  pthread_mutex_unlock(&feedlock);
+}
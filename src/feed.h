@@ -0,0 +1,29 @@
+#ifndef FEED_H
+#define FEED_H
+
+#include "scheduler.h"
+
+
+/**
+ * @brief Subscribes `ctx` to the changes made to a room
+ * `notify` is called from the feed's own thread, once per change, in the
+ * order the changes were published; returning non-zero cancels the
+ * subscription.  `release` is called once the feed is done with `ctx`.
+ * @return 0 on success, 1 if `ctx` already watches the room
+ */
+int feed_watch(int room, sched_notify_t notify, void (*release)(void *),
+               void *ctx);
+
+/**
+ * @brief Cancels the subscriptions of `ctx` to a room, or to all if negative
+ * @return The number of subscriptions cancelled
+ */
+int feed_unwatch(int room, const void *ctx);
+
+/**
+ * @brief Queues a change for the subscribers of its room, without blocking
+ * @param change SCHED_RESERVED or SCHED_REMOVED
+ */
+void feed_publish(int change, const reservation_t *reservation);
+
+#endif
@@ -0,0 +1,339 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+
+#define JOURNAL_MAGIC "SCHDJRNL"
+
+typedef struct jheader_s {
+  char magic[8];
+  uint64_t generation;
+} jheader_t;
+
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t pending;
+  pthread_cond_t synced;
+  pthread_t thread;
+  char *path;
+  int fd;
+  uint64_t gen;
+  jrec_t *buf;
+  size_t len;
+  size_t cap;
+  // the buffer being written out, swapped with `buf` by each flush
+  jrec_t *spare;
+  size_t spare_cap;
+  size_t records;
+  uint64_t seq;
+  uint64_t done;
+  int failed;
+  void (*checkpoint)(void);
+} jnl = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+          PTHREAD_COND_INITIALIZER };
+
+
+static uint32_t jrec_check(const jrec_t *rec)
+{
+  const unsigned char *p = (const unsigned char*)rec;
+  uint32_t hash = 2166136261u;
+  size_t i;
+
+  for (i = 0; i < offsetof(jrec_t, check); i++)
+    hash = (hash ^ p[i]) * 16777619u;
+  // records outside a batch keep the checksum they always had
+  if (rec->more)
+    for (i = offsetof(jrec_t, more); i < sizeof(jrec_t); i++)
+      hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+/* Where the journal of generation `gen` is kept once rotated out */
+static char *journal_genpath(const char *path, uint64_t gen)
+{
+  char *old = malloc(strlen(path) + 22);
+  sprintf(old, "%s.%llu", path, (unsigned long long)gen);
+  return old;
+}
+
+static int journal_write(int fd, const void *buf, size_t len)
+{
+  ssize_t w;
+
+  for (; len; len -= w, buf = (const char*)buf + w)
+    if (0 > (w = write(fd, buf, len)))
+      return -1;
+  return 0;
+}
+
+static int journal_create(const char *path, uint64_t gen)
+{
+  jheader_t header;
+  int fd;
+
+  if (0 > (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)))
+    return -1;
+  memcpy(header.magic, JOURNAL_MAGIC, 8);
+  header.generation = gen;
+  if (0 != journal_write(fd, &header, sizeof(jheader_t)) ||
+      0 != fdatasync(fd)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/* Writes out everything queued.  Called with the lock held, which is let
+ * go during the write so that writers can queue the next batch meanwhile;
+ * only the sync thread flushes, so writes never overlap.  A failed write
+ * latches `failed`: what follows it could not be replayed anyway. */
+static void journal_flush(void)
+{
+  jrec_t *buf;
+  size_t len, cap;
+  uint64_t seq;
+  int status;
+
+  if (jnl.len == 0 || jnl.failed)
+    return;
+  buf = jnl.buf;
+  len = jnl.len;
+  cap = jnl.cap;
+  seq = jnl.seq;
+  jnl.buf = jnl.spare;
+  jnl.cap = jnl.spare_cap;
+  jnl.len = 0;
+  pthread_mutex_unlock(&jnl.lock);
+  status = journal_write(jnl.fd, buf, len * sizeof(jrec_t));
+  if (status == 0)
+    status = fdatasync(jnl.fd);
+  pthread_mutex_lock(&jnl.lock);
+  jnl.spare = buf;
+  jnl.spare_cap = cap;
+  if (status == 0) {
+    jnl.records += len;
+    jnl.done = seq;
+  } else {
+    syslog(LOG_ERR, "journal %s: write failed, refusing changes", jnl.path);
+    jnl.failed = 1;
+  }
+  pthread_cond_broadcast(&jnl.synced);
+}
+
+
+static uint64_t journal_replay_file(const char *path, uint64_t after,
+                                    void (*apply)(const jrec_t *))
+{
+  jheader_t header;
+  jrec_t *batch;
+  size_t len, cap;
+  off_t valid;
+  size_t i;
+  int fd;
+
+  if (0 > (fd = open(path, O_RDWR)))
+    return after;
+  if (sizeof(jheader_t) != read(fd, &header, sizeof(jheader_t)) ||
+      0 != memcmp(header.magic, JOURNAL_MAGIC, 8) ||
+      header.generation <= after) {
+    close(fd);
+    return after;
+  }
+  valid = sizeof(jheader_t);
+  batch = NULL;
+  len = cap = 0;
+  while (1) {
+    if (len == cap) {
+      cap = cap ? cap * 2 : 16;
+      batch = realloc(batch, cap * sizeof(jrec_t));
+    }
+    if (sizeof(jrec_t) != read(fd, batch+len, sizeof(jrec_t)) ||
+        batch[len].check != jrec_check(batch+len) ||
+        (len > 0 && batch[len].more != batch[len-1].more - 1))
+      break;
+    if (batch[len++].more)
+      continue;
+    for (i = 0; i < len; i++)
+      apply(batch+i);
+    valid += len * sizeof(jrec_t);
+    len = 0;
+  }
+  free(batch);
+  // drop a torn tail (or half a batch) so new records are not appended after garbage
+  if (0 != ftruncate(fd, valid))
+    syslog(LOG_ERR, "journal %s: could not truncate torn tail", path);
+  close(fd);
+  return header.generation;
+}
+
+/* Whether the journal of generation `gen` is still set aside */
+static int journal_kept(const char *path, uint64_t gen)
+{
+  char *old = journal_genpath(path, gen);
+  int kept = (0 == access(old, F_OK));
+  free(old);
+  return kept;
+}
+
+/* Generations are numbered one after another and only retired once a
+ * checkpoint covers them, so those after `after` are all still there */
+uint64_t journal_replay(const char *path, uint64_t after,
+                        void (*apply)(const jrec_t *))
+{
+  char *old;
+  uint64_t gen, n;
+
+  gen = after;
+  for (n = after+1; journal_kept(path, n); n++) {
+    old = journal_genpath(path, n);
+    gen = journal_replay_file(old, gen, apply);
+    free(old);
+  }
+  return journal_replay_file(path, gen, apply);
+}
+
+
+static void *journal_main(void *_)
+{
+  pthread_mutex_lock(&jnl.lock);
+  while (1) {
+    while (jnl.len == 0)
+      pthread_cond_wait(&jnl.pending, &jnl.lock);
+    // everything queued while the previous sync ran goes out in one batch
+    journal_flush();
+    if (jnl.records > JOURNAL_CHECKPOINT && jnl.checkpoint) {
+      pthread_mutex_unlock(&jnl.lock);
+      jnl.checkpoint();
+      pthread_mutex_lock(&jnl.lock);
+    }
+  }
+  return NULL;
+}
+
+int journal_open(const char *path, uint64_t gen, void (*checkpoint)(void))
+{
+  if (0 > (jnl.fd = journal_create(path, gen)))
+    return -1;
+  jnl.path = strdup(path);
+  jnl.gen = gen;
+  jnl.checkpoint = checkpoint;
+  if (0 != pthread_create(&jnl.thread, NULL, journal_main, NULL) ||
+      0 != pthread_detach(jnl.thread))
+    return -1;
+  return 0;
+}
+
+
+uint64_t journal_append(const jrec_t *rec)
+{
+  return journal_append_batch(rec, 1);
+}
+
+uint64_t journal_append_batch(const jrec_t *recs, size_t count)
+{
+  uint64_t seq;
+  size_t i;
+
+  // queued under one lock, so a batch is never split across two writes
+  pthread_mutex_lock(&jnl.lock);
+  if (jnl.failed) {
+    pthread_mutex_unlock(&jnl.lock);
+    return 0;
+  }
+  while (jnl.len + count > jnl.cap) {
+    jnl.cap = jnl.cap ? jnl.cap * 2 : 256;
+    jnl.buf = realloc(jnl.buf, jnl.cap * sizeof(jrec_t));
+  }
+  for (i = 0; i < count; i++) {
+    jnl.buf[jnl.len] = recs[i];
+    jnl.buf[jnl.len].more = count - 1 - i;
+    jnl.buf[jnl.len].check = jrec_check(jnl.buf+jnl.len);
+    jnl.len++;
+  }
+  jnl.seq += count;
+  seq = jnl.seq;
+  pthread_cond_signal(&jnl.pending);
+  pthread_mutex_unlock(&jnl.lock);
+  return seq;
+}
+
+int journal_wait(uint64_t seq)
+{
+  int status;
+
+  pthread_mutex_lock(&jnl.lock);
+  while (jnl.done < seq && !jnl.failed)
+    pthread_cond_wait(&jnl.synced, &jnl.lock);
+  status = jnl.done < seq ? -1 : 0;
+  pthread_mutex_unlock(&jnl.lock);
+  return status;
+}
+
+
+uint64_t journal_rotate(void)
+{
+  char *old;
+  uint64_t gen;
+  int failed;
+  int fd;
+
+  pthread_mutex_lock(&jnl.lock);
+  journal_flush();
+  failed = jnl.failed;
+  gen = jnl.gen;
+  pthread_mutex_unlock(&jnl.lock);
+  // a checkpoint now would make changes that were refused durable
+  if (failed)
+    return 0;
+  // appends are held off by the caller and only this thread writes, so the
+  // file can be swapped without the lock
+  old = journal_genpath(jnl.path, gen);
+  fd = -1;
+  if (0 == rename(jnl.path, old) &&
+      0 > (fd = journal_create(jnl.path, gen+1)))
+    rename(old, jnl.path);
+  if (fd < 0) {
+    // keep appending to the current file and retry after as many records
+    syslog(LOG_ERR, "journal %s: could not rotate", jnl.path);
+    pthread_mutex_lock(&jnl.lock);
+    jnl.records = 0;
+    pthread_mutex_unlock(&jnl.lock);
+    free(old);
+    return 0;
+  }
+  close(jnl.fd);
+  pthread_mutex_lock(&jnl.lock);
+  jnl.fd = fd;
+  jnl.gen = gen+1;
+  jnl.records = 0;
+  pthread_mutex_unlock(&jnl.lock);
+  free(old);
+  return gen;
+}
+
+/* Oldest first, so an interrupted retire leaves no gap in the generations.
+ * The newest ones may not have been set aside (at startup, `gen` is the
+ * journal being replaced). */
+void journal_retire(uint64_t gen)
+{
+  char *old;
+  uint64_t n;
+
+  for (n = gen; n > 0 && !journal_kept(jnl.path, n); n--)
+    ;
+  for (; n > 0 && journal_kept(jnl.path, n); n--)
+    ;
+  for (n++; n <= gen; n++) {
+    old = journal_genpath(jnl.path, n);
+    unlink(old);
+    free(old);
+  }
+}
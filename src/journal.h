@@ -0,0 +1,86 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef JOURNAL_CHECKPOINT
+#define JOURNAL_CHECKPOINT (1 << 20)
+#endif
+
+#define JOURNAL_RESERVE 1
+#define JOURNAL_REMOVE 2
+#define JOURNAL_ARCHIVE 3
+
+
+/* A single journaled operation, written to disk as is.
+ * An archive record only uses `start`, as the cut-off time.
+ * `more` counts the records that follow in the same batch; a batch is only
+ * replayed once all of its records made it to disk. */
+typedef struct jrec_s {
+  uint32_t op;
+  int32_t room_id;
+  int32_t id;
+  int32_t user_id;
+  int64_t start;
+  int64_t end;
+  uint32_t check;
+  uint32_t more;
+} jrec_t;
+
+
+/**
+ * @brief Replays the journal at `path` and those rotated out to `path`.N
+ * Only files with a generation newer than `after` are replayed, oldest
+ * first; a torn record at the tail of a file ends its replay.
+ * @return The newest generation found, or `after` if there was none
+ */
+uint64_t journal_replay(const char *path, uint64_t after,
+                        void (*apply)(const jrec_t *));
+
+/**
+ * @brief Starts a fresh journal file of generation `gen` and its sync thread
+ * Generations start at 1 and any existing file at `path` is replaced, so it
+ * must already be covered by a checkpoint.
+ * `checkpoint` is called from the sync thread once the journal holds more
+ * than JOURNAL_CHECKPOINT records; it is expected to call `journal_rotate`.
+ */
+int journal_open(const char *path, uint64_t gen, void (*checkpoint)(void));
+
+/**
+ * @brief Queues a record for the journal
+ * @return A sequence number to pass to `journal_wait`, 0 if the journal has
+ *         failed and takes no more records
+ */
+uint64_t journal_append(const jrec_t *);
+
+/**
+ * @brief Queues `count` records that are replayed all together or not at all
+ * @return The sequence number of the last record, or 0 as `journal_append`
+ */
+uint64_t journal_append_batch(const jrec_t *recs, size_t count);
+
+/**
+ * @brief Blocks until the record with sequence `seq` is on disk
+ * Records are synced in batches, so concurrent writers share one fsync.
+ * @return 0 once it is, negative if the journal failed before it was
+ */
+int journal_wait(uint64_t seq);
+
+/**
+ * @brief Syncs the current journal, sets it aside and starts the next one
+ * The journal is renamed after its generation, so one set aside earlier and
+ * not yet retired is kept.  Must be called from the `checkpoint` callback, and the caller must ensure
+ * no records are appended concurrently.
+ * @return The generation of the journal that was set aside, 0 on failure
+ *         or if the journal has failed
+ */
+uint64_t journal_rotate(void);
+
+/**
+ * @brief Deletes the journals set aside by `journal_rotate` up to `gen`
+ * Called once a checkpoint covering them is safely on disk.
+ */
+void journal_retire(uint64_t gen);
+
+#endif
@@ -20,18 +20,36 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "scheduler.h"
+#include "solver.h"
+#include "stats.h"
+#include "strbuf.h"
 #include "telnet.h"
+#include "timefmt.h"
 
 #ifndef PORT
 #define PORT 3165
 #endif
 
+/* Reservations a listing reads and sends at a time */
+#ifndef LIST_PAGE
+#define LIST_PAGE 256
+#endif
+
+/* Directory, relative to where the daemon runs, that the `x` command
+ * writes its exports into */
+#ifndef EXPORT_DIR
+#define EXPORT_DIR "exports"
+#endif
+
 const char STR_IDPRMPT[] = "Please enter your user id: ";
 
 const char STR_HELP[] = "Welcome to the scheduling system.\n"
@@ -39,131 +57,871 @@ const char STR_HELP[] = "Welcome to the scheduling system.\n"
   "- l - list the rooms\n"
   "- s ROOM - list the reservations for a room\n"
   "- r ROOM YYYY-MM-DD hh:mm YYYY-MM-DD hh:mm - reserve a room for a specified amount of time (ISO 8601 extended format)\n"
+  "- b ROOM YYYY-MM-DD hh:mm YYYY-MM-DD hh:mm [ROOM ...] - reserve several rooms and/or times at once; either all are reserved or none are\n"
+  "- w ROOM YYYY-MM-DD hh:mm YYYY-MM-DD hh:mm - reserve a room, or join its waitlist if that time is taken (you are emailed once it is reserved)\n"
+  "- w - list the reservations you are waiting for\n"
+  "- wd ROOM YYYY-MM-DD hh:mm - stop waiting for your reservation that occurs during this time in a room\n"
   "- u - list your reservations\n"
+  "- watch ROOM - be sent each reservation made in or removed from a room as it happens\n"
+  "- unwatch [ROOM] - stop watching a room, or every room\n"
+  "- a [ROOM [YYYY-MM-DD]] - show how much a room is booked on a day (default today), in its week and by hour; without a room, your own totals\n"
+  "- p [ROOM] - list past (archived) reservations for a room, or your own\n"
   "- d ROOM YYYY-MM-DD hh:mm - delete your reservation that occurs during this time in a room\n"
+  "- d ID - delete your reservation with this id (ids are shown as #ID)\n"
+  "- x csv|json FILE - (admin) export all reservations to a file in the server's export directory\n"
+  "- stats - (admin) show how long each command and scheduler call has taken: count, median, 90th and 99th percentiles and maximum\n"
+  "- mode text|tsv|json - reply in this text, or for scripts in one record per line (tab-separated or JSON, times in seconds since the epoch) ended by a status line\n"
   "- q - quit\n> ";
 
+/* How a session's replies are written: for people, or as one record per
+ * line followed by a status line, for scripts */
+#define MODE_TEXT 0
+#define MODE_TSV 1
+#define MODE_JSON 2
+
+/* What a reply reports, which is its code in the status line */
+#define STATUS_OK 0
+#define STATUS_REFUSED 1
+#define STATUS_WAITLISTED 2
+#define STATUS_UNKNOWN 3
+
+static const char *const STR_STATUS[3][4] = {
+  { "OKAY!\n> ", "NOT OKAY!\n> ", "WAITLISTED!\n> ", "UNKNOWN COMMAND!\n> " },
+  { "status\t0\n", "status\t1\n", "status\t2\n", "status\t3\n" },
+  { "{\"status\":0}\n", "{\"status\":1}\n", "{\"status\":2}\n",
+    "{\"status\":3}\n" }
+};
+
+/* What ends a listing: the prompt, or the status line */
+static const char *const STR_DONE[3] = {
+  "> ", "status\t0\n", "{\"status\":0}\n"
+};
+
+/* Enough for a reservation as any mode writes it, with its terminator */
+#define RECORD_SIZE 192
+
+/* The room listing, rendered once for every session until the rooms
+ * change; each session holds the one it was last sent until its next reply */
+typedef struct roomlist_s {
+  int refs;
+  long version;
+  char str[];
+} roomlist_t;
+
+/* What the interface keeps for a session between its commands; `line` and
+ * `argv` hold the command being run, split up in place.  A listing being
+ * sent reads its next page from `page` for `page_of` (a room or user), after
+ * the last reservation of the `listed` in `listing`. */
+typedef struct client_s {
+  char state;
+  int mode;
+  user_t user;
+  strbuf_t out;
+  roomlist_t *rooms;
+  strbuf_t line;
+  char **argv;
+  size_t argv_cap;
+  ssize_t (*page)(int, const reservation_t *, reservation_t *, size_t);
+  int page_of;
+  reservation_t *listing;
+  ssize_t listed;
+} client_t;
+
+/* A command: its name, how many arguments it takes (`max_args` negative
+ * for any number) and what runs it, given the arguments after the name */
+typedef struct command_s {
+  const char *name;
+  int min_args;
+  int max_args;
+  const char *(*run)(client_t *client, int argc, char **argv);
+} command_t;
+
+static roomlist_t *roomlist[3] = { NULL, NULL, NULL };
+static pthread_mutex_t roomlistlock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Maps an export format name to its SCHED_EXPORT_* value, -1 if unknown */
+static int export_format(const char *name)
+{
+  if (!name)
+    return -1;
+  if (0 == strcmp(name, "csv"))
+    return SCHED_EXPORT_CSV;
+  if (0 == strcmp(name, "json"))
+    return SCHED_EXPORT_JSON;
+  return -1;
+}
+
+
+/* Reads a whole decimal number; non-zero if `str` is anything else */
+static int parse_int(const char *str, int *value)
+{
+  char *end;
+  long n;
+
+  n = strtol(str, &end, 10);
+  if (end == str || *end || n < -2147483647L || n > 2147483647L)
+    return 1;
+  *value = n;
+  return 0;
+}
+
+/* Reads "ROOM YYYY-MM-DD hh:mm YYYY-MM-DD hh:mm" from five arguments;
+ * non-zero if any is malformed */
+static int parse_reservation(char **argv, reservation_t *reservation)
+{
+  if (0 != parse_int(argv[0], &reservation->room_id) ||
+      0 != timefmt_parse(argv[1], argv[2], &reservation->start) ||
+      0 != timefmt_parse(argv[3], argv[4], &reservation->end))
+    return 1;
+  return 0;
+}
+
+
+/* Appends `len` characters as a JSON string, or null if there are none */
+static void render_json_string(strbuf_t *out, const char *str, size_t len)
+{
+  const char *end = str + len;
+
+  if (!len) {
+    strbuf_cat(out, "null");
+    return;
+  }
+  strbuf_cat(out, "\"");
+  for (; str < end; str++) {
+    if (*str == '"' || *str == '\\')
+      strbuf_printf(out, "\\%c", *str);
+    else if ((unsigned char)*str < 0x20)
+      strbuf_printf(out, "\\u%04x", (unsigned char)*str);
+    else
+      strbuf_ncat(out, str, 1);
+  }
+  strbuf_cat(out, "\"");
+}
+
+/* Appends a string as one tab-separated field, its tabs and line breaks
+ * made spaces */
+static void render_tsv_string(strbuf_t *out, const char *str)
+{
+  size_t at = out->len;
+
+  strbuf_cat(out, str);
+  for (; at < out->len; at++)
+    if (out->str[at] == '\t' || out->str[at] == '\n' || out->str[at] == '\r')
+      out->str[at] = ' ';
+}
+
+
+static void roomlist_release(roomlist_t *list)
+{
+  int last;
+
+  if (!list)
+    return;
+  pthread_mutex_lock(&roomlistlock);
+  last = (--list->refs == 0);
+  pthread_mutex_unlock(&roomlistlock);
+  if (last)
+    free(list);
+}
+
+/* Appends a room as `mode` lists it */
+static void render_room(strbuf_t *out, int mode, const room_t *room)
+{
+  if (mode == MODE_TSV) {
+    strbuf_printf(out, "%d\t%d\t%d\t", room->id, room->capacity, room->sqft);
+    render_tsv_string(out, room->note);
+    strbuf_cat(out, "\n");
+  } else if (mode == MODE_JSON) {
+    strbuf_printf(out, "{\"id\":%d,\"capacity\":%d,\"sqft\":%d,\"note\":",
+                  room->id, room->capacity, room->sqft);
+    render_json_string(out, room->note, strlen(room->note));
+    strbuf_cat(out, "}\n");
+  } else if (room->note[0] == 0) {
+    strbuf_printf(out, "ROOM %4d | %d people (%d sqft)\n", room->id,
+                  room->capacity, room->sqft);
+  } else {
+    strbuf_printf(out, "ROOM %4d | %d people (%d sqft) (%s)\n", room->id,
+                  room->capacity, room->sqft, room->note);
+  }
+}
+
+/* The current room listing in a mode, held for the caller */
+static roomlist_t *roomlist_get(int mode)
+{
+  strbuf_t out = { NULL, 0, 0 };
+  roomlist_t *list, *old;
+  room_t *rooms;
+  ssize_t cnt, i;
+  // read before the rooms, so a change made while rendering is seen next time
+  long version = sched_rooms_version();
+
+  pthread_mutex_lock(&roomlistlock);
+  if ((list = roomlist[mode]) && version >= 0 && list->version == version) {
+    list->refs++;
+    pthread_mutex_unlock(&roomlistlock);
+    return list;
+  }
+  pthread_mutex_unlock(&roomlistlock);
+  cnt = sched_rooms(NULL);
+  rooms = malloc((cnt > 0 ? cnt : 1) * sizeof(room_t));
+  cnt = sched_rooms(rooms);
+  strbuf_reserve(&out, cnt > 0 ? cnt * 48 : 0);
+  for (i = 0; i < cnt; i++)
+    render_room(&out, mode, rooms+i);
+  free(rooms);
+  strbuf_cat(&out, STR_DONE[mode]);
+  list = malloc(sizeof(roomlist_t) + out.len + 1);
+  // one for the cache, one for the caller
+  list->refs = 2;
+  list->version = version;
+  memcpy(list->str, out.str, out.len + 1);
+  strbuf_free(&out);
+  pthread_mutex_lock(&roomlistlock);
+  old = roomlist[mode];
+  roomlist[mode] = list;
+  pthread_mutex_unlock(&roomlistlock);
+  roomlist_release(old);
+  return list;
+}
+
+
+/* Writes a reservation as a line of a listing in `mode`, preceded by
+ * `event` (which the text mode takes as a prefix, the others as a field)
+ * if there is one; `line` holds RECORD_SIZE characters */
+static int render_record(char *line, int mode, const char *event,
+                         const reservation_t *r)
+{
+  char start[TIMEFMT_SIZE], end[TIMEFMT_SIZE];
+  int len = 0;
+
+  if (mode == MODE_TSV) {
+    if (event)
+      len = sprintf(line, "%s\t", event);
+    return len + sprintf(line+len, "%d\t%d\t%d\t%lld\t%lld\n", r->id,
+                         r->room_id, r->user_id, (long long)r->start,
+                         (long long)r->end);
+  }
+  if (mode == MODE_JSON) {
+    len = sprintf(line, "{");
+    if (event)
+      len += sprintf(line+len, "\"event\":\"%s\",", event);
+    return len + sprintf(line+len, "\"id\":%d,\"room_id\":%d,\"user_id\":%d,"
+                         "\"start_time\":%lld,\"end_time\":%lld}\n", r->id,
+                         r->room_id, r->user_id, (long long)r->start,
+                         (long long)r->end);
+  }
+  timefmt_ctime(r->start, start);
+  timefmt_ctime(r->end, end);
+  if (event)
+    return sprintf(line, "%s %d - %s - %s\n", event, r->room_id, start, end);
+  len = sprintf(line, "%d - %s - %s", r->room_id, start, end);
+  if (r->id)
+    len += sprintf(line+len, " - #%d", r->id);
+  return len + sprintf(line+len, "\n");
+}
+
+/* Pushes a change to a watched room to the watching session, in the mode
+ * it was in when it started watching */
+static int watch_notify(void *session, int mode, int change,
+                        const reservation_t *reservation)
+{
+  static const char *const events[3][2] = {
+    { "RESERVED", "REMOVED" },
+    { "reserved", "removed" },
+    { "reserved", "removed" }
+  };
+  char line[RECORD_SIZE];
+
+  render_record(line, mode, events[mode][change != SCHED_RESERVED],
+                reservation);
+  return telnet_write(session, line);
+}
+
+static int watch_notify_text(void *session, int change,
+                             const reservation_t *reservation)
+{
+  return watch_notify(session, MODE_TEXT, change, reservation);
+}
+
+static int watch_notify_tsv(void *session, int change,
+                            const reservation_t *reservation)
+{
+  return watch_notify(session, MODE_TSV, change, reservation);
+}
+
+static int watch_notify_json(void *session, int change,
+                             const reservation_t *reservation)
+{
+  return watch_notify(session, MODE_JSON, change, reservation);
+}
+
+static void watch_release(void *session)
+{
+  telnet_release(session);
+}
+
+
+/* The reply that reports `status` in the session's mode */
+static const char *reply_status(const client_t *client, int status)
+{
+  return STR_STATUS[client->mode][status];
+}
+
+/* Appends one line per reservation to a reply */
+static void render_reservations(strbuf_t *out, int mode,
+                                const reservation_t *reservs, ssize_t cnt)
+{
+  char line[RECORD_SIZE];
+  ssize_t i;
+
+  // a line is at most about 80 characters
+  strbuf_reserve(out, cnt > 0 ? cnt * 80 : 0);
+  for (i = 0; i < cnt; i++)
+    strbuf_ncat(out, line, render_record(line, mode, NULL, reservs+i));
+}
+
+/* Renders the next page of the listing being sent, and the prompt after the
+ * last; NULL once it is all sent */
+static const char *list_next(client_t *client)
+{
+  reservation_t after;
+  ssize_t cnt;
+
+  if (!client->page)
+    return NULL;
+  strbuf_reset(&client->out);
+  if (client->listed)
+    after = client->listing[client->listed-1];
+  cnt = client->page(client->page_of, client->listed ? &after : NULL,
+                     client->listing, LIST_PAGE);
+  client->listed = cnt > 0 ? cnt : 0;
+  render_reservations(&client->out, client->mode, client->listing, cnt);
+  // a short page is the last
+  if (cnt < LIST_PAGE) {
+    client->page = NULL;
+    strbuf_cat(&client->out, STR_DONE[client->mode]);
+  }
+  return client->out.str;
+}
+
+/* Starts sending a listing, which goes out a page at a time */
+static const char *list_start(client_t *client, ssize_t (*page)(int,
+                              const reservation_t *, reservation_t *, size_t),
+                              int of)
+{
+  if (!client->listing)
+    client->listing = malloc(LIST_PAGE * sizeof(reservation_t));
+  client->page = page;
+  client->page_of = of;
+  client->listed = 0;
+  return list_next(client);
+}
+
+
+static const char *cmd_quit(client_t *client, int argc, char **argv)
+{
+  return NULL;
+}
+
+static const char *cmd_help(client_t *client, int argc, char **argv)
+{
+  // the text without its prompt, as lines or as one JSON record
+  if (client->mode == MODE_TSV) {
+    strbuf_ncat(&client->out, STR_HELP, sizeof(STR_HELP) - 3);
+  } else if (client->mode == MODE_JSON) {
+    strbuf_cat(&client->out, "{\"help\":");
+    render_json_string(&client->out, STR_HELP, sizeof(STR_HELP) - 3);
+    strbuf_cat(&client->out, "}\n");
+  } else {
+    return STR_HELP;
+  }
+  strbuf_cat(&client->out, STR_DONE[client->mode]);
+  return client->out.str;
+}
+
+static const char *cmd_mode(client_t *client, int argc, char **argv)
+{
+  static const char *const modes[3] = { "text", "tsv", "json" };
+  int mode;
+
+  for (mode = 0; mode < 3; mode++)
+    if (0 == strcmp(argv[0], modes[mode]))
+      break;
+  if (mode == 3)
+    return reply_status(client, STATUS_REFUSED);
+  client->mode = mode;
+  return reply_status(client, STATUS_OK);
+}
+
+static const char *cmd_rooms(client_t *client, int argc, char **argv)
+{
+  client->rooms = roomlist_get(client->mode);
+  return client->rooms->str;
+}
+
+static const char *cmd_watch(client_t *client, int argc, char **argv)
+{
+  static int (*const notify[3])(void *, int, const reservation_t *) = {
+    watch_notify_text, watch_notify_tsv, watch_notify_json
+  };
+  telnet_session_t *session = telnet_self();
+  int room;
+  int status;
+
+  // commands run from a file have no session to push changes to
+  if (!session || 0 != parse_int(argv[0], &room))
+    return reply_status(client, STATUS_REFUSED);
+  status = sched_watch(room, notify[client->mode], watch_release,
+                       telnet_hold(session));
+  // a subscription that was not made never releases its hold
+  if (status != 0)
+    telnet_release(session);
+  return reply_status(client, status >= 0 ? STATUS_OK : STATUS_REFUSED);
+}
+
+static const char *cmd_unwatch(client_t *client, int argc, char **argv)
+{
+  int room = -1;
+
+  if (argc && 0 != parse_int(argv[0], &room))
+    return reply_status(client, STATUS_REFUSED);
+  return reply_status(client, sched_unwatch(room, telnet_self()) > 0 ?
+                      STATUS_OK : STATUS_REFUSED);
+}
+
+static const char *cmd_usage(client_t *client, int argc, char **argv)
+{
+  strbuf_t *out = &client->out;
+  struct tm tm;
+  usage_t usage;
+  time_t booked, count, day;
+  char date[16], week[16];
+  int roomid;
+  int peak;
+  int i, j;
+
+  if (argc == 0) {
+    sched_usage_user(client->user.id, &booked, &count);
+    if (client->mode == MODE_TSV)
+      strbuf_printf(out, "%d\t%ld\t%ld\n", client->user.id, (long)booked,
+                    (long)count);
+    else if (client->mode == MODE_JSON)
+      strbuf_printf(out, "{\"user_id\":%d,\"booked\":%ld,\"count\":%ld}\n",
+                    client->user.id, (long)booked, (long)count);
+    else
+      strbuf_printf(out, "YOU HAVE BOOKED %ld MINUTES IN %ld RESERVATIONS\n",
+                    (long)booked / 60, (long)count);
+    strbuf_cat(out, STR_DONE[client->mode]);
+    return out->str;
+  }
+  if (0 != parse_int(argv[0], &roomid))
+    return reply_status(client, STATUS_REFUSED);
+  // noon is on the right day whatever the daylight saving rules
+  if (argc > 1) {
+    if (0 != timefmt_parse(argv[1], "12:00", &day))
+      return reply_status(client, STATUS_REFUSED);
+  } else {
+    day = time(NULL);
+    localtime_r(&day, &tm);
+    tm.tm_hour = 12;
+    tm.tm_min = tm.tm_sec = 0;
+    tm.tm_isdst = -1;
+    day = mktime(&tm);
+  }
+  localtime_r(&day, &tm);
+  sched_usage_room(roomid, day, &usage);
+  strftime(date, sizeof(date), "%Y-%m-%d", &tm);
+  tm.tm_mday -= (tm.tm_wday + 6) % 7;
+  mktime(&tm);
+  strftime(week, sizeof(week), "%Y-%m-%d", &tm);
+  // fold the days of the week together into hours of the day
+  for (i = 0; i < 24; i++)
+    for (j = 1; j < 7; j++)
+      usage.hours[i] += usage.hours[j * 24 + i];
+  if (client->mode == MODE_TSV) {
+    strbuf_printf(out, "%d\t%s\t%ld\t%s\t%ld", roomid, date,
+                  (long)usage.day, week, (long)usage.week);
+    for (i = 0; i < 24; i++)
+      strbuf_printf(out, "\t%ld", (long)usage.hours[i]);
+    strbuf_cat(out, "\n");
+  } else if (client->mode == MODE_JSON) {
+    strbuf_printf(out, "{\"room_id\":%d,\"date\":\"%s\",\"day\":%ld,"
+                  "\"week_of\":\"%s\",\"week\":%ld,\"hours\":[", roomid, date,
+                  (long)usage.day, week, (long)usage.week);
+    for (i = 0; i < 24; i++)
+      strbuf_printf(out, i ? ",%ld" : "%ld", (long)usage.hours[i]);
+    strbuf_cat(out, "]}\n");
+  } else {
+    strbuf_printf(out, "ROOM %d | %s | %ld minutes booked (%ld%%)\n", roomid,
+                  date, (long)usage.day / 60,
+                  (long)usage.day * 100 / (24 * 3600));
+    strbuf_printf(out, "ROOM %d | week of %s | %ld minutes booked "
+                  "(%ld%%)\n", roomid, week, (long)usage.week / 60,
+                  (long)usage.week * 100 / (7 * 24 * 3600));
+    for (peak = i = 0; i < 24; i++)
+      if (usage.hours[i] > usage.hours[peak])
+        peak = i;
+    for (i = 0; i < 24; i++)
+      strbuf_printf(out, "%02d:00 | %ld minutes booked%s\n", i,
+                    (long)usage.hours[i] / 60,
+                    (i == peak && usage.hours[i]) ? " (PEAK)" : "");
+  }
+  strbuf_cat(out, STR_DONE[client->mode]);
+  return out->str;
+}
+
+static const char *cmd_waitlist(client_t *client, int argc, char **argv)
+{
+  reservation_t reservation;
+  reservation_t *reservs;
+  ssize_t cnt;
+  int status;
+
+  if (argc == 0) {
+    cnt = sched_waitlist_user(client->user.id, &reservs);
+    render_reservations(&client->out, client->mode, reservs, cnt);
+    strbuf_cat(&client->out, STR_DONE[client->mode]);
+    free(reservs);
+    return client->out.str;
+  }
+  if (argc != 5)
+    return reply_status(client, STATUS_REFUSED);
+  memset(&reservation, 0, sizeof(reservation_t));
+  reservation.user_id = client->user.id;
+  if (0 != parse_reservation(argv, &reservation))
+    return reply_status(client, STATUS_REFUSED);
+  status = sched_waitlist(reservation, client->user);
+  if (status == 0)
+    return reply_status(client, STATUS_OK);
+  return reply_status(client, status > 0 ? STATUS_WAITLISTED : STATUS_REFUSED);
+}
+
+static const char *cmd_unwait(client_t *client, int argc, char **argv)
+{
+  time_t at;
+  int id;
+
+  if (0 != parse_int(argv[0], &id) ||
+      0 != timefmt_parse(argv[1], argv[2], &at) ||
+      0 >= sched_waitlist_cancel(id, at, client->user))
+    return reply_status(client, STATUS_REFUSED);
+  return reply_status(client, STATUS_OK);
+}
+
+static const char *cmd_user(client_t *client, int argc, char **argv)
+{
+  return list_start(client, sched_page_user, client->user.id);
+}
+
+static const char *cmd_room(client_t *client, int argc, char **argv)
+{
+  int roomid;
+
+  if (0 != parse_int(argv[0], &roomid))
+    return reply_status(client, STATUS_REFUSED);
+  return list_start(client, sched_page_room, roomid);
+}
+
+static const char *cmd_history(client_t *client, int argc, char **argv)
+{
+  reservation_t *reservs;
+  ssize_t cnt;
+  int roomid;
+
+  if (argc) {
+    if (0 != parse_int(argv[0], &roomid))
+      return reply_status(client, STATUS_REFUSED);
+    cnt = sched_history_room(roomid, &reservs);
+  } else {
+    cnt = sched_history_user(client->user.id, &reservs);
+  }
+  render_reservations(&client->out, client->mode, reservs, cnt);
+  strbuf_cat(&client->out, STR_DONE[client->mode]);
+  free(reservs);
+  return client->out.str;
+}
+
+static const char *cmd_reserve(client_t *client, int argc, char **argv)
+{
+  reservation_t reservation;
+  int id;
+
+  memset(&reservation, 0, sizeof(reservation_t));
+  reservation.user_id = client->user.id;
+  if (0 != parse_reservation(argv, &reservation) ||
+      0 >= (id = sched_reserve(reservation, client->user)))
+    return reply_status(client, STATUS_REFUSED);
+  if (client->mode == MODE_TSV)
+    strbuf_printf(&client->out, "status\t%d\t%d\n", STATUS_OK, id);
+  else if (client->mode == MODE_JSON)
+    strbuf_printf(&client->out, "{\"status\":%d,\"id\":%d}\n", STATUS_OK, id);
+  else
+    strbuf_printf(&client->out, "OKAY! #%d\n> ", id);
+  return client->out.str;
+}
+
+static const char *cmd_batch(client_t *client, int argc, char **argv)
+{
+  reservation_t *batch;
+  int cnt = argc / 5;
+  int status = 0;
+  int i;
+
+  if (argc % 5)
+    return reply_status(client, STATUS_REFUSED);
+  batch = calloc(cnt, sizeof(reservation_t));
+  for (i = 0; i < cnt && status == 0; i++) {
+    batch[i].user_id = client->user.id;
+    status = parse_reservation(argv + 5 * i, batch+i);
+  }
+  if (status == 0)
+    status = sched_reserve_batch(batch, cnt, client->user);
+  free(batch);
+  return reply_status(client, status == 0 ? STATUS_OK : STATUS_REFUSED);
+}
+
+static const char *cmd_delete(client_t *client, int argc, char **argv)
+{
+  time_t at;
+  int id;
+
+  if (argc == 1) {
+    // a lone number is a reservation id
+    if (0 != parse_int(argv[0] + (argv[0][0] == '#'), &id))
+      return reply_status(client, STATUS_REFUSED);
+    return reply_status(client, sched_remove_id(id, client->user) == 0 ?
+                        STATUS_OK : STATUS_REFUSED);
+  }
+  if (argc != 3 || 0 != parse_int(argv[0], &id) ||
+      0 != timefmt_parse(argv[1], argv[2], &at))
+    return reply_status(client, STATUS_REFUSED);
+  return reply_status(client, sched_remove(id, at, at, client->user) >= 0 ?
+                      STATUS_OK : STATUS_REFUSED);
+}
+
+/* Exports go to a plain file name in EXPORT_DIR, written to a temporary
+ * file there first so the name is only ever replaced by a whole export */
+static const char *cmd_export(client_t *client, int argc, char **argv)
+{
+  char path[256];
+  char tmp[256];
+  int format;
+  int fd;
+
+  if (client->user.status != 2 || 0 > (format = export_format(argv[0])) ||
+      argv[1][0] == '\0' || argv[1][0] == '.' || strchr(argv[1], '/') ||
+      sizeof(path) <= (size_t)snprintf(path, sizeof(path), "%s/%s",
+                                       EXPORT_DIR, argv[1]) ||
+      sizeof(tmp) <= (size_t)snprintf(tmp, sizeof(tmp), "%s/.%s.XXXXXX",
+                                      EXPORT_DIR, argv[1]) ||
+      0 > (fd = mkstemp(tmp)))
+    return reply_status(client, STATUS_REFUSED);
+  if (0 != fchmod(fd, 0644) || 0 != sched_export(fd, format) ||
+      0 != fsync(fd))
+    format = -1;
+  if (0 != close(fd))
+    format = -1;
+  if (format >= 0 && 0 != rename(tmp, path))
+    format = -1;
+  if (format < 0)
+    unlink(tmp);
+  return reply_status(client, format >= 0 ? STATUS_OK : STATUS_REFUSED);
+}
+
+static const char *cmd_stats(client_t *client, int argc, char **argv)
+{
+  stats_t stats[STATS_MAX];
+  size_t cnt, i;
+
+  if (client->user.status != 2)
+    return reply_status(client, STATUS_REFUSED);
+  cnt = stats_read(stats);
+  for (i = 0; i < cnt; i++) {
+    if (client->mode == MODE_TSV)
+      strbuf_printf(&client->out, "%s\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+                    stats[i].name, (unsigned long long)stats[i].count,
+                    (unsigned long long)stats[i].p50,
+                    (unsigned long long)stats[i].p90,
+                    (unsigned long long)stats[i].p99,
+                    (unsigned long long)stats[i].max);
+    else if (client->mode == MODE_JSON)
+      strbuf_printf(&client->out, "{\"name\":\"%s\",\"count\":%llu,"
+                    "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}\n",
+                    stats[i].name, (unsigned long long)stats[i].count,
+                    (unsigned long long)stats[i].p50,
+                    (unsigned long long)stats[i].p90,
+                    (unsigned long long)stats[i].p99,
+                    (unsigned long long)stats[i].max);
+    else
+      strbuf_printf(&client->out, "%s | %llu calls | p50 %.1fus | p90 %.1fus"
+                    " | p99 %.1fus | max %.1fus\n", stats[i].name,
+                    (unsigned long long)stats[i].count, stats[i].p50 / 1e3,
+                    stats[i].p90 / 1e3, stats[i].p99 / 1e3,
+                    stats[i].max / 1e3);
+  }
+  strbuf_cat(&client->out, STR_DONE[client->mode]);
+  return client->out.str;
+}
+
+static const command_t commands[] = {
+  { "q", 0, 0, cmd_quit },
+  { "h", 0, 0, cmd_help },
+  { "l", 0, 0, cmd_rooms },
+  { "s", 1, 1, cmd_room },
+  { "r", 5, 5, cmd_reserve },
+  { "b", 5, -1, cmd_batch },
+  { "w", 0, 5, cmd_waitlist },
+  { "wd", 3, 3, cmd_unwait },
+  { "u", 0, 0, cmd_user },
+  { "watch", 1, 1, cmd_watch },
+  { "unwatch", 0, 1, cmd_unwatch },
+  { "a", 0, 2, cmd_usage },
+  { "p", 0, 1, cmd_history },
+  { "d", 1, 3, cmd_delete },
+  { "x", 2, 2, cmd_export },
+  { "mode", 1, 1, cmd_mode },
+  { "stats", 0, 0, cmd_stats },
+  { NULL, 0, 0, NULL }
+};
+
+/* The ids the commands' latencies are recorded under, registered at
+ * startup */
+static int command_timed[sizeof(commands) / sizeof(commands[0])];
+
+
+/* Splits `input` into words in the client's own buffers, which are kept
+ * from command to command; returns the number of words */
+static int tokenize(client_t *client, const char *input)
+{
+  char *p;
+  int argc = 0;
+
+  strbuf_reset(&client->line);
+  strbuf_cat(&client->line, input);
+  for (p = client->line.str; *(p += strspn(p, " \t")); ) {
+    if (argc == client->argv_cap) {
+      client->argv_cap = client->argv_cap ? client->argv_cap * 2 : 16;
+      client->argv = realloc(client->argv, client->argv_cap * sizeof(char*));
+    }
+    client->argv[argc++] = p;
+    p += strcspn(p, " \t");
+    if (*p)
+      *p++ = 0;
+  }
+  return argc;
+}
+
 
 /* The callback for the telnet session for each user */
 const char *interface(const char *input, void **data)
 {
-  char state;
+  const command_t *command;
+  const char *reply;
+  client_t *client;
   user_t user;
-  char *obuf;
+  uint64_t start;
+  int argc;
 
   if (!input) {
     if (*data == NULL) {
       // initializing state!
-      *data = malloc(sizeof(char) * 4096);
-      *((char*)(*data)) = 0;
+      *data = calloc(1, sizeof(client_t));
     } else {
       // closing state!
-      free(*data);
+      client = *data;
+      sched_unwatch(-1, telnet_self());
+      roomlist_release(client->rooms);
+      strbuf_free(&client->out);
+      strbuf_free(&client->line);
+      free(client->argv);
+      free(client->listing);
+      free(client);
+      *data = NULL;
       return "GOODBYE!\n";
     }
   }
   // system state
-  state = *((char*)(*data));
-  memcpy(&user, (*data)+sizeof(char), sizeof(user_t));
-  obuf = ((char*)((*data)+sizeof(char)+sizeof(user_t)));
-  if (state == 0) {
-    *((char*)(*data)) = 1;
+  client = *data;
+  // the previous reply has been sent, so its buffer is reused
+  strbuf_reset(&client->out);
+  roomlist_release(client->rooms);
+  client->rooms = NULL;
+  client->page = NULL;
+  if (client->state == 0) {
+    client->state = 1;
     return STR_IDPRMPT;
   }
-  if (state == 1) {
-    *((char*)(*data)) = 2;
+  if (client->state == 1) {
+    client->state = 2;
     user = sched_user(atoi(input));
     if (user.id != atoi(input))
       return NULL;
-    memcpy((*data)+sizeof(char), &user, sizeof(user_t));
+    client->user = user;
     return STR_HELP;
   }
 
-  if (input[0] == 'q')
-    return NULL;
-  if (input[0] == 'h')
-    return STR_HELP;
-  if (input[0] == 'l') {
-    size_t cnt;
-    size_t i;
-    room_t *rooms;
-    const char withoutnote[] = "ROOM %4d | %d people (%d sqft)\n";
-    const char withnote[] = "ROOM %4d | %d people (%d sqft) (%s)\n";
-
-    cnt = sched_rooms(NULL);
-    rooms = malloc(cnt * sizeof(room_t));
-    sched_rooms(rooms);
-    *obuf = 0;
-    for (i = 0; i < cnt; i++)
-      sprintf(obuf+strlen(obuf),
-              rooms[i].note[0] == 0 ? withoutnote : withnote,
-              rooms[i].id,
-              rooms[i].capacity,
-              rooms[i].sqft,
-              rooms[i].note);
-    sprintf(obuf+strlen(obuf), "> ");
-    return obuf;
-  }
-  if (input[0] == 'u' || input[0] == 's') {
-    ssize_t cnt;
-    reservation_t *reservs;
-    ssize_t i;
-
-    if (input[0] == 'u') {
-      cnt = sched_reservations_user(user.id, NULL);
-      reservs = malloc(sizeof(reservation_t) * cnt);
-      sched_reservations_user(user.id, reservs);
-    }
-    if (input[0] == 's') {
-      int roomid;
-      char *buf = strdup(input+2);
-      roomid = atoi(strtok(buf, " \t"));
-      cnt = sched_reservations_room(roomid, NULL);
-      reservs = malloc(sizeof(reservation_t) * cnt);
-      sched_reservations_room(roomid, reservs);
-    }
-    *obuf = 0;
-    for (i = 0; i < cnt; i++) {
-      sprintf(obuf+strlen(obuf), "%d - %s", reservs[i].room_id, ctime(&reservs[i].start));
-      sprintf(obuf+strlen(obuf)-1, " - %s", ctime(&reservs[i].end));
-      sprintf(obuf+strlen(obuf)-1, "\n");
-    }
-    sprintf(obuf+strlen(obuf), "> ");
-    return obuf;
-  }
-  if (input[0] == 'r') {
-    struct tm tm_start, tm_end;
-    memset(&tm_start, 0, sizeof(struct tm));
-    memset(&tm_end, 0, sizeof(struct tm));
-    char *buf = strdup(input+2);
-    int roomid = atoi(strtok(buf, " \t"));
-    strptime(strtok(NULL, " \t"), "%Y-%m-%d", &tm_start);
-    strptime(strtok(NULL, " \t"), "%H:%M", &tm_start);
-    strptime(strtok(NULL, " \t"), "%Y-%m-%d", &tm_end);
-    strptime(strtok(NULL, " \t"), "%H:%M", &tm_end);
-    free(buf);
-    reservation_t reservation = { .room_id = roomid,
-                                  .user_id = user.id,
-                                  .start = mktime(&tm_start),
-                                  .end = mktime(&tm_end) };
-    if (0 != sched_reserve(reservation, user)) {
-      return "NOT OKAY!\n> ";
-    } else {
-      return "OKAY!\n> ";
-    }
+  if (0 == (argc = tokenize(client, input)))
+    return STR_DONE[client->mode];
+  for (command = commands; command->name; command++)
+    if (0 == strcmp(command->name, client->argv[0]))
+      break;
+  if (!command->name)
+    return reply_status(client, STATUS_UNKNOWN);
+  if (argc-1 < command->min_args ||
+      (command->max_args >= 0 && argc-1 > command->max_args))
+    return reply_status(client, STATUS_REFUSED);
+  start = stats_now();
+  reply = command->run(client, argc-1, client->argv+1);
+  stats_record(command_timed[command - commands], start);
+  return reply;
+}
+
+/* The continuation of the interface's replies: the rest of a listing */
+const char *interface_more(void **data)
+{
+  return *data ? list_next(*data) : NULL;
+}
+
+
+/* Runs the commands read from `in` as if `user` had typed them into a
+ * session, writing the replies to `out`.  Lines starting with '#' are
+ * skipped, so a plan from the solver runs as it is.
+ * Returns non-zero if there is no such user. */
+static int batch_run(FILE *in, FILE *out, const char *user)
+{
+  strbuf_t line = { NULL, 0, 0 };
+  char chunk[512];
+  const char *reply;
+  void *data = NULL;
+  int status = 0;
+
+  // the prompt for the user id, then the welcome
+  interface(NULL, &data);
+  if (!interface(user, &data)) {
+    fprintf(stderr, "UNKNOWN USER %s\n", user);
+    status = 1;
   }
-  if (input[0] == 'd') {
-    struct tm tmtime;
-    memset(&tmtime, 0, sizeof(struct tm));
-    char *buf = strdup(input+2);
-    int roomid = atoi(strtok(buf, " \t"));
-    strptime(strtok(NULL, " \t"), "%Y-%m-%d", &tmtime);
-    strptime(strtok(NULL, " \t"), "%H:%M", &tmtime);
-    free(buf);
-    sched_remove(roomid, mktime(&tmtime), mktime(&tmtime), user);
-    return "OKAY!\n> ";
+  while (status == 0 && fgets(chunk, sizeof(chunk), in)) {
+    strbuf_cat(&line, chunk);
+    if (line.str[line.len-1] != '\n' && !feof(in))
+      continue;
+    while (line.len && (line.str[line.len-1] == '\n' ||
+                        line.str[line.len-1] == '\r'))
+      line.str[--line.len] = 0;
+    if (line.str[0] != '#') {
+      if (!(reply = interface(line.str, &data)))
+        break;
+      do
+        fputs(reply, out);
+      while ((reply = interface_more(&data)));
+    }
+    strbuf_reset(&line);
   }
-  return "UNKNOWN COMMAND!\n";
+  strbuf_free(&line);
+  interface(NULL, &data);
+  fflush(out);
+  return status;
 }
 
 
@@ -171,17 +929,92 @@ int main(int argc, char **argv)
 {
   telnet_t telnet;
   pthread_t *thread;
+  const char *dbpath = "db.db3";
+  const char *solve = NULL;
+  const char *script = NULL;
+  const char *user = NULL;
+  FILE *in;
+  int export = -1;
+  int archive = 0;
+  int opt;
+  int i;
 
-  if (argc > 1) {
-    if (0 != sched_load(argv[1]))
-      fprintf(stderr, "COULD NOT LOAD DATABASE %s\n", argv[1]);
-  } else {
-    if (0 != sched_load("db.db3"))
-      fprintf(stderr, "COULD NOT LOAD DATABASE db.db3");
+  while (-1 != (opt = getopt(argc, argv, "a:b:c:s:u:x:"))) {
+    switch (opt) {
+    case 'a':
+      if (0 >= (archive = atoi(optarg))) {
+        fprintf(stderr, "INVALID ARCHIVE HORIZON %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'b':
+      if (0 != sched_backend(optarg)) {
+        fprintf(stderr, "UNKNOWN BACKEND %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'c':
+      script = optarg;
+      break;
+    case 's':
+      solve = optarg;
+      break;
+    case 'u':
+      user = optarg;
+      break;
+    case 'x':
+      if (0 > (export = export_format(optarg))) {
+        fprintf(stderr, "UNKNOWN EXPORT FORMAT %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-a days] [-b sqlite|memory|journal] "
+              "[-s requests] [-u user -c commands] [-x csv|json] [db3]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (!script != !user) {
+    fprintf(stderr, "BATCH MODE NEEDS BOTH -c AND -u\n");
+    return 1;
   }
+  if (optind < argc)
+    dbpath = argv[optind];
+  for (i = 0; commands[i].name; i++)
+    command_timed[i] = stats_metric(commands[i].name);
+  if (0 != sched_load(dbpath)) {
+    fprintf(stderr, "COULD NOT LOAD DATABASE %s\n", dbpath);
+    if (export >= 0 || solve || script)
+      return 1;
+  }
+  if (export >= 0)
+    return sched_export(STDOUT_FILENO, export) == 0 ? 0 : 1;
+  if (solve) {
+    if (!(in = strcmp(solve, "-") ? fopen(solve, "r") : stdin)) {
+      fprintf(stderr, "COULD NOT OPEN %s\n", solve);
+      return 1;
+    }
+    opt = solver_run(in, stdout);
+    fclose(in);
+    return opt == 0 ? 0 : 1;
+  }
+  if (script) {
+    if (!(in = strcmp(script, "-") ? fopen(script, "r") : stdin)) {
+      fprintf(stderr, "COULD NOT OPEN %s\n", script);
+      return 1;
+    }
+    opt = batch_run(in, stdout, user);
+    fclose(in);
+    return opt;
+  }
+
+  if (archive > 0)
+    assert(0 == sched_archiver((time_t)archive * 24 * 60 * 60));
 
   telnet = telnet_init(PORT);
   assert(0 == telnet_listener(&telnet, interface));
+  assert(0 == telnet_more(&telnet, interface_more));
   assert(NULL != (thread = telnet_start(&telnet)));
   pthread_join(*thread, NULL);
 
@@ -0,0 +1,38 @@
+#include "minutes.h"
+
+
+static int minute_pack(time_t t, minute_t *minute)
+{
+  int64_t since = (int64_t)t - MINUTE_EPOCH;
+
+  if (since % 60 != 0 || since / 60 < INT32_MIN || since / 60 > INT32_MAX)
+    return -1;
+  *minute = since / 60;
+  return 0;
+}
+
+static time_t minute_time(minute_t minute)
+{
+  return (time_t)MINUTE_EPOCH + (time_t)minute * 60;
+}
+
+
+int cres_pack(cres_t *packed, int id, int other, time_t start, time_t end)
+{
+  minute_t s, e;
+
+  if (0 != minute_pack(start, &s) || 0 != minute_pack(end, &e))
+    return -1;
+  packed->id = id;
+  packed->other = other;
+  packed->start = s;
+  packed->end = e;
+  return 0;
+}
+
+
+void cres_unpack(const cres_t *packed, time_t *start, time_t *end)
+{
+  *start = minute_time(packed->start);
+  *end = minute_time(packed->end);
+}
@@ -0,0 +1,40 @@
+#ifndef MINUTES_H
+#define MINUTES_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* The time (in seconds since 1970) that packed minutes count from */
+#ifndef MINUTE_EPOCH
+#define MINUTE_EPOCH 1388534400
+#endif
+
+
+/* Bookings are made to the minute, so the in-memory indexes keep their
+ * times as 32-bit minutes from MINUTE_EPOCH (about 4000 years either way)
+ * and convert back at their edges. */
+typedef int32_t minute_t;
+
+/* A reservation packed to 16 bytes; whichever of its room and its user is
+ * implied by where it is kept is left out, the other is `other`. */
+typedef struct cres_s {
+  int32_t id;
+  int32_t other;
+  minute_t start;
+  minute_t end;
+} cres_t;
+
+
+/**
+ * @brief Packs a reservation
+ * @return 0 on success, non-zero (leaving `packed` unset) if either time is
+ *         not a whole minute or out of range, i.e. would not unpack exactly
+ */
+int cres_pack(cres_t *packed, int id, int other, time_t start, time_t end);
+
+/**
+ * @brief Unpacks the times of a packed reservation
+ */
+void cres_unpack(const cres_t *packed, time_t *start, time_t *end);
+
+#endif
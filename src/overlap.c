@@ -0,0 +1,91 @@
+#include "overlap.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define OVERLAP_X86 1
+#include <immintrin.h>
+#endif
+
+
+size_t overlap_find_scalar(const int64_t *starts, const int64_t *ends,
+                           size_t n, int64_t start, int64_t end)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (start < ends[i] && end > starts[i])
+      return i;
+  return n;
+}
+
+
+#ifdef OVERLAP_X86
+/* Four intervals per iteration: start < ends[i] && starts[i] < end */
+__attribute__((target("avx2")))
+static size_t overlap_find_avx2(const int64_t *starts, const int64_t *ends,
+                                size_t n, int64_t start, int64_t end)
+{
+  const __m256i vstart = _mm256_set1_epi64x(start);
+  const __m256i vend = _mm256_set1_epi64x(end);
+  __m256i hit;
+  int mask;
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    hit = _mm256_and_si256(
+      _mm256_cmpgt_epi64(_mm256_loadu_si256((const __m256i*)(ends+i)), vstart),
+      _mm256_cmpgt_epi64(vend, _mm256_loadu_si256((const __m256i*)(starts+i))));
+    if ((mask = _mm256_movemask_pd(_mm256_castsi256_pd(hit))))
+      return i + __builtin_ctz(mask);
+  }
+  return i + overlap_find_scalar(starts+i, ends+i, n-i, start, end);
+}
+
+/* Two intervals per iteration; 64-bit compares need SSE4.2 */
+__attribute__((target("sse4.2")))
+static size_t overlap_find_sse42(const int64_t *starts, const int64_t *ends,
+                                 size_t n, int64_t start, int64_t end)
+{
+  const __m128i vstart = _mm_set1_epi64x(start);
+  const __m128i vend = _mm_set1_epi64x(end);
+  __m128i hit;
+  int mask;
+  size_t i;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    hit = _mm_and_si128(
+      _mm_cmpgt_epi64(_mm_loadu_si128((const __m128i*)(ends+i)), vstart),
+      _mm_cmpgt_epi64(vend, _mm_loadu_si128((const __m128i*)(starts+i))));
+    if ((mask = _mm_movemask_pd(_mm_castsi128_pd(hit))))
+      return i + __builtin_ctz(mask);
+  }
+  return i + overlap_find_scalar(starts+i, ends+i, n-i, start, end);
+}
+#endif
+
+
+static size_t overlap_find_init(const int64_t *, const int64_t *, size_t,
+                                int64_t, int64_t);
+
+static size_t (*overlap_impl)(const int64_t *, const int64_t *, size_t,
+                              int64_t, int64_t) = overlap_find_init;
+
+/* Picks the implementation on first use; racing threads pick the same */
+static size_t overlap_find_init(const int64_t *starts, const int64_t *ends,
+                                size_t n, int64_t start, int64_t end)
+{
+  overlap_impl = overlap_find_scalar;
+#ifdef OVERLAP_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    overlap_impl = overlap_find_avx2;
+  else if (__builtin_cpu_supports("sse4.2"))
+    overlap_impl = overlap_find_sse42;
+#endif
+  return overlap_impl(starts, ends, n, start, end);
+}
+
+size_t overlap_find(const int64_t *starts, const int64_t *ends, size_t n,
+                    int64_t start, int64_t end)
+{
+  return overlap_impl(starts, ends, n, start, end);
+}
@@ -0,0 +1,24 @@
+#ifndef OVERLAP_H
+#define OVERLAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * @brief Finds the first interval overlapping [start, end)
+ * The intervals are given as parallel arrays of starts and ends.  The
+ * widest vector unit the CPU supports (AVX2, SSE4.2) is picked on the first
+ * call, with a scalar loop as the fallback.
+ * @return The index of the first overlapping interval, or `n` if none
+ */
+size_t overlap_find(const int64_t *starts, const int64_t *ends, size_t n,
+                    int64_t start, int64_t end);
+
+/**
+ * @brief The scalar version of `overlap_find`, for comparison
+ */
+size_t overlap_find_scalar(const int64_t *starts, const int64_t *ends,
+                           size_t n, int64_t start, int64_t end);
+
+#endif
@@ -3,402 +3,591 @@
 #include <string.h>
 #include <syslog.h>
 #include <pthread.h>
+#include <unistd.h>
 
+#include "admission.h"
+#include "backend.h"
 #include "email.h"
+#include "feed.h"
 #include "scheduler.h"
-#include "sqlite3.h"
-
-
-static sqlite3 *db = NULL;
-static pthread_rwlock_t dblock = PTHREAD_RWLOCK_INITIALIZER;
-static pthread_mutex_t _adminlock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t adminlock = PTHREAD_MUTEX_INITIALIZER;
-static size_t admin_c = 0;
-static pthread_mutex_t _studentlock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t studentlock = PTHREAD_MUTEX_INITIALIZER;
-static size_t student_c = 0;
+#include "stats.h"
+#include "uindex.h"
+#include "usage.h"
+#include "waitlist.h"
+
+#ifndef ARCHIVE_INTERVAL
+#define ARCHIVE_INTERVAL 3600
+#endif
+
+
+static const backend_t *backends[] = {
+  &backend_sqlite, &backend_memory, &backend_journal, NULL
+};
+static const backend_t *backend = &backend_sqlite;
+static time_t archive_horizon = 0;
+static pthread_t archive_thread;
+// the number of the last change published; the index and the watchers
+// take changes in the order the backend numbered them
+static uint64_t published = 0;
+static pthread_mutex_t orderlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ordered = PTHREAD_COND_INITIALIZER;
+
+/* The calls whose latency is recorded, with their ids in the stats */
+#define TIMED_USER 0
+#define TIMED_ROOMS 1
+#define TIMED_PAGE_ROOM 2
+#define TIMED_PAGE_USER 3
+#define TIMED_RESERVE 4
+#define TIMED_RESERVE_BATCH 5
+#define TIMED_REMOVE 6
+#define TIMED_REMOVE_ID 7
+#define TIMED_WAITLIST 8
+#define TIMED_USAGE_ROOM 9
+#define TIMED_USAGE_USER 10
+#define TIMED_HISTORY_ROOM 11
+#define TIMED_HISTORY_USER 12
+#define TIMED_EXPORT 13
+static const char *const timed_names[] = {
+  "sched_user", "sched_rooms", "sched_page_room", "sched_page_user",
+  "sched_reserve", "sched_reserve_batch", "sched_remove", "sched_remove_id",
+  "sched_waitlist", "sched_usage_room", "sched_usage_user",
+  "sched_history_room", "sched_history_user", "sched_export"
+};
+static int timed[sizeof(timed_names) / sizeof(timed_names[0])];
+
+
+/* Backends fill plain arrays; the public API hands back linked ones */
+static void link_reservations(reservation_t *reservations, ssize_t count)
+{
+  ssize_t i;
+  for (i = 0; i < count; i++)
+    reservations[i].next = (i+1 < count) ? reservations+(i+1) : NULL;
+}
 
 
-static int dbfail()
+int sched_backend(const char *name)
 {
-  syslog(LOG_ERR, sqlite3_errmsg(db));
-  sqlite3_close(db);
-  db = NULL;
+  size_t i;
+
+  for (i = 0; backends[i]; i++) {
+    if (0 == strcmp(backends[i]->name, name)) {
+      backend = backends[i];
+      return 0;
+    }
+  }
   return -1;
 }
 
+/* Builds the user index and usage totals from the stored reservations;
+ * archived ones still count towards usage */
+static void sched_index(void)
+{
+  room_t *rooms;
+  reservation_t *reservations;
+  ssize_t room_c, count;
+  ssize_t i, j;
+
+  room_c = backend->rooms(NULL);
+  if (room_c <= 0)
+    return;
+  rooms = malloc(room_c * sizeof(room_t));
+  room_c = backend->rooms(rooms);
+  for (i = 0; i < room_c; i++) {
+    count = backend->reservations_room(rooms[i].id, NULL);
+    if (count > 0) {
+      reservations = malloc(count * sizeof(reservation_t));
+      count = backend->reservations_room(rooms[i].id, reservations);
+      for (j = 0; j < count; j++) {
+        uindex_add(reservations+j);
+        usage_add(reservations+j, 1);
+      }
+      free(reservations);
+    }
+    count = backend->history_room(rooms[i].id, &reservations);
+    for (j = 0; j < count; j++)
+      usage_add(reservations+j, 1);
+    free(reservations);
+  }
+  free(rooms);
+}
 
-//static int compar_int_room(const void *a, const void *b)
-//{ return (*((int*)a)) - ((room_t*)b)->id; }
+/* Waits until the changes this thread made are durable; negative if they
+ * could not be made so, though they are still in the store */
+static int sched_sync(void)
+{
+  return backend->sync ? backend->sync() : 0;
+}
 
+/* Brings everything derived from the reservations up to date with a change
+ * the backend has made; called in order by `sched_publish` */
+static void sched_changed(int change, const reservation_t *reservation)
+{
+  if (change == SCHED_RESERVED)
+    uindex_add(reservation);
+  else
+    uindex_remove(reservation);
+  usage_add(reservation, change == SCHED_RESERVED ? 1 : -1);
+  feed_publish(change, reservation);
+}
 
-static int sql_exec_quiet(const char *sql)
+/* Publishes the reservations a backend change numbered `order` made or
+ * removed, once every change numbered before it has been.  A change that
+ * took a number but failed still has to pass through, with no reservations,
+ * so the ones after it are not held up. */
+static void sched_publish(uint64_t order, int change,
+                          const reservation_t *reservations, ssize_t count)
 {
-  sqlite3_stmt *stmt;
-  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                   &stmt, NULL))
-    return 1;
-  if (SQLITE_DONE != sqlite3_step(stmt))
-    return 1;
-  sqlite3_finalize(stmt);
-  return 0;
+  ssize_t i;
+
+  if (order == 0)
+    return;
+  pthread_mutex_lock(&orderlock);
+  while (published + 1 != order)
+    pthread_cond_wait(&ordered, &orderlock);
+  for (i = 0; i < count; i++)
+    sched_changed(change, reservations+i);
+  published = order;
+  pthread_cond_broadcast(&ordered);
+  pthread_mutex_unlock(&orderlock);
 }
 
 int sched_load(const char *dbpath)
 {
   int status;
+  size_t i;
 
-  if (SQLITE_OK != sqlite3_open(dbpath, &db))
-    return dbfail();
-  // ensure the proper tables exist
-  status = 0;
-  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS user ("
-                           "id INTEGER PRIMARY KEY,"
-                           "status INTEGER NOT NULL,"
-                           "email TEXT NOT NULL)");
-  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS room ("
-                           "id INTEGER PRIMARY KEY,"
-                           "size INTEGER NOT NULL,"
-                           "sqft INTEGER NOT NULL,"
-                           "capacity INTEGER NOT NULL,"
-                           "note TEXT)");
-  status |= sql_exec_quiet("CREATE TABLE IF NOT EXISTS reservation ("
-                           "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-                           "room_id INTEGER NOT NULL,"
-                           "user_id INTEGER NOT NULL,"
-                           "start_time INTEGER NOT NULL,"
-                           "end_time INTEGER NOT NULL)");
-  if (status != 0)
-    return dbfail();
-  // OK
-  return 0;
+  for (i = 0; i < sizeof(timed) / sizeof(timed[0]); i++)
+    timed[i] = stats_metric(timed_names[i]);
+  status = backend->load(dbpath);
+  if (status == 0)
+    sched_index();
+  return status;
 }
 
 
 user_t sched_user(int id)
 {
-  char sql[128];
-  sqlite3_stmt *stmt;
+  uint64_t start = stats_now();
   user_t user;
 
-  sprintf(sql, "SELECT * FROM user WHERE (id=%d)", id);
   memset(&user, 0, sizeof(user_t));
-  user.id = id+1;
-  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                   &stmt, NULL)) {
-    dbfail();
-    return user;
-  }
-  switch(sqlite3_step(stmt)) {
-  case SQLITE_ROW:
-    user.id = sqlite3_column_int(stmt, 0);
-    user.status = sqlite3_column_int(stmt, 1);
-    strncpy(user.email, (const char*)sqlite3_column_text(stmt, 2), 63);
-  case SQLITE_DONE:
-    sqlite3_finalize(stmt);
-    break;
-  case SQLITE_ERROR:
-    dbfail();
-    break;
-  default:
-    syslog(LOG_ERR, "The SQLITE API is broken");
+  if (0 != backend->user(id, &user)) {
+    memset(&user, 0, sizeof(user_t));
+    user.id = id+1;
   }
+  stats_record(timed[TIMED_USER], start);
   return user;
 }
 
 
 room_t sched_room(int id)
 {
-  char sql[128];
-  sqlite3_stmt *stmt;
   room_t room;
 
-  sprintf(sql, "SELECT * FROM room WHERE id=%d", id);
   memset(&room, 0, sizeof(room_t));
-  room.id = id+1;
-  pthread_rwlock_rdlock(&dblock);
-  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                   &stmt, NULL)) {
-    dbfail();
-    return room;
+  if (0 != backend->room(id, &room)) {
+    memset(&room, 0, sizeof(room_t));
+    room.id = id+1;
   }
-  switch(sqlite3_step(stmt)) {
-  case SQLITE_ROW:
-    room.id = sqlite3_column_int(stmt, 0);
-    room.size = sqlite3_column_int(stmt, 1);
-    room.sqft = sqlite3_column_int(stmt, 2);
-    room.capacity = sqlite3_column_int(stmt, 3);
-    if (sqlite3_column_text(stmt, 4) != NULL)
-      strncpy(room.note, (const char*)sqlite3_column_text(stmt, 4), 63);
-    else
-      room.note[0] = 0;
-  case SQLITE_DONE:
-    sqlite3_finalize(stmt);
-    break;
-  case SQLITE_ERROR:
-    dbfail();
-    break;
-  default:
-    syslog(LOG_ERR, "The SQLITE API is broken");
-  }
-  pthread_rwlock_unlock(&dblock);
   return room;
 }
 
 
 ssize_t sched_rooms(room_t *rooms)
 {
-  const char sql_count[] = "SELECT COUNT(*) FROM room";
-  const char sql_select[] = "SELECT * FROM room ORDER BY id ASC";
-  sqlite3_stmt *stmt;
-  size_t count;
-  int status;
+  uint64_t start = stats_now();
+  ssize_t count = backend->rooms(rooms);
 
-  if (!rooms) {
-    if (SQLITE_OK != sqlite3_prepare(db, sql_count,
-                                     strlen(sql_count) * sizeof(char),
-                                     &stmt, NULL))
-      return dbfail();
-    if (SQLITE_ROW != sqlite3_step(stmt))
-      return dbfail();
-    count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    return count;
-  }
-  if (SQLITE_OK != sqlite3_prepare(db, sql_select,
-                                   strlen(sql_select) * sizeof(char),
-                                   &stmt, NULL))
-    return dbfail();
-  count = 0;
-  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
-    rooms[count].id = sqlite3_column_int(stmt, 0);
-    rooms[count].size = sqlite3_column_int(stmt, 1);
-    rooms[count].sqft = sqlite3_column_int(stmt, 2);
-    rooms[count].capacity = sqlite3_column_int(stmt, 3);
-    if (sqlite3_column_text(stmt, 4) != NULL)
-      strncpy(rooms[count].note, (const char*)sqlite3_column_text(stmt, 4), 63);
-    else
-      rooms[count].note[0] = 0;
-    count++;
-  }
-  if (SQLITE_DONE != status)
-    return dbfail();
-  sqlite3_finalize(stmt);
+  stats_record(timed[TIMED_ROOMS], start);
   return count;
 }
 
 
-ssize_t sched_reservations_room(int room, reservation_t *reservations)
+long sched_rooms_version(void)
 {
-  char sql[128];
-  sqlite3_stmt *stmt;
-  size_t count;
-  int status;
+  return backend->rooms_version ? backend->rooms_version() : 0;
+}
 
-  if (!reservations) {
-    sprintf(sql, "SELECT COUNT(*) FROM reservation WHERE room_id=%d", room);
-    pthread_rwlock_rdlock(&dblock);
-    if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                     &stmt, NULL))
-      goto failure;
-    if (SQLITE_ROW != sqlite3_step(stmt))
-      goto failure;
-    count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    pthread_rwlock_unlock(&dblock);
-    return count;
-  failure:
-    pthread_rwlock_unlock(&dblock);
-    return dbfail();
-  }
-  sprintf(sql, "SELECT * FROM reservation WHERE room_id=%d "
-          "ORDER BY start_time ASC", room);
-  pthread_rwlock_rdlock(&dblock);
-  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                   &stmt, NULL))
-    return dbfail();
-  count = 0;
-  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
-    reservations[count].room_id = sqlite3_column_int(stmt, 1);
-    reservations[count].user_id = sqlite3_column_int(stmt, 2);
-    reservations[count].start = (time_t)sqlite3_column_int64(stmt, 3);
-    reservations[count].end = (time_t)sqlite3_column_int64(stmt, 4);
-    reservations[count].next = reservations+(count+1);
-    count++;
-  }
-  reservations[count-1].next = NULL;
-  if (SQLITE_DONE != status)
-    return dbfail();
-  sqlite3_finalize(stmt);
-  pthread_rwlock_unlock(&dblock);
+
+ssize_t sched_reservations_room(int room, reservation_t *reservations)
+{
+  ssize_t count = backend->reservations_room(room, reservations);
+  if (reservations)
+    link_reservations(reservations, count);
   return count;
 }
 
 
 ssize_t sched_reservations_user(int user, reservation_t *reservations)
 {
-  char sql[128];
-  sqlite3_stmt *stmt;
-  size_t count;
-  int status;
+  ssize_t count = uindex_user(user, reservations);
+  if (reservations)
+    link_reservations(reservations, count);
+  return count;
+}
 
-  if (!reservations) {
-    sprintf(sql, "SELECT COUNT(*) FROM reservation WHERE user_id=%d", user);
-    pthread_rwlock_rdlock(&dblock);
-    if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                     &stmt, NULL))
-      goto failure;
-    if (SQLITE_ROW != sqlite3_step(stmt))
-      goto failure;
-    count = sqlite3_column_int(stmt, 0);
-    sqlite3_finalize(stmt);
-    pthread_rwlock_unlock(&dblock);
-    return count;
-  failure:
-    pthread_rwlock_unlock(&dblock);
-    return dbfail();
-  }
-  sprintf(sql, "SELECT * FROM reservation WHERE user_id=%d "
-          "ORDER BY start_time ASC", user);
-  pthread_rwlock_rdlock(&dblock);
-  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                   &stmt, NULL))
-    return dbfail();
-  count = 0;
-  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
-    reservations[count].room_id = sqlite3_column_int(stmt, 1);
-    reservations[count].user_id = sqlite3_column_int(stmt, 2);
-    reservations[count].start = (time_t)sqlite3_column_int64(stmt, 3);
-    reservations[count].end = (time_t)sqlite3_column_int64(stmt, 4);
-    reservations[count].next = reservations+(count+1);
-    count++;
-  }
-  reservations[count-1].next = NULL;
-  if (SQLITE_DONE != status)
-    return dbfail();
-  sqlite3_finalize(stmt);
-  pthread_rwlock_unlock(&dblock);
+
+ssize_t sched_page_room(int room, const reservation_t *after,
+                        reservation_t *reservations, size_t max)
+{
+  uint64_t start = stats_now();
+  ssize_t count = backend->page_room(room, after, reservations, max);
+
+  link_reservations(reservations, count);
+  stats_record(timed[TIMED_PAGE_ROOM], start);
   return count;
 }
 
 
-int sched_reserve(reservation_t reservation, user_t user)
+ssize_t sched_page_user(int user, const reservation_t *after,
+                        reservation_t *reservations, size_t max)
 {
-  char sql_roomcheck[128];
-  reservation_t *query;
-  char sql[256];
-  int status;
-  reservation_t *reservations;
-  ssize_t reservation_c;
-
-  switch(user.status) {
-  case 2: // admin
-    pthread_mutex_lock(&_adminlock);
-    if (admin_c == 0)
-      pthread_mutex_lock(&adminlock);
-    admin_c++;
-    pthread_mutex_unlock(&_adminlock);
-    break;
-  case 0: // student
-    pthread_mutex_lock(&adminlock);
-    pthread_mutex_lock(&_studentlock);
-    if (student_c == 0)
-      pthread_mutex_lock(&studentlock);
-    student_c++;
-    pthread_mutex_unlock(&_studentlock);
-    break;
-  case 1: // faculty
-    pthread_mutex_lock(&adminlock);
-    pthread_mutex_lock(&studentlock);
-    break;
-  }
-  sprintf(sql_roomcheck, "SELECT * FROM room WHERE id=%d",
-          reservation.room_id);
-  if (sched_room(reservation.room_id).id == reservation.room_id) {
-    reservation_c = sched_reservations_room(reservation.room_id, NULL);
-    reservations = malloc(reservation_c * sizeof(reservation_t));
-    sched_reservations_room(reservation.room_id, reservations);
-  }
+  uint64_t start = stats_now();
+  ssize_t count = uindex_user_page(user, after, reservations, max);
+
+  link_reservations(reservations, count);
+  stats_record(timed[TIMED_PAGE_USER], start);
+  return count;
+}
+
+
+static int reservation_cmp(const void *a, const void *b)
+{
+  const reservation_t *x = a, *y = b;
+  if (x->room_id != y->room_id)
+    return x->room_id < y->room_id ? -1 : 1;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return 0;
+}
+
+
+/* Validates and stores a batch in place, setting the ids */
+static int reserve_batch(reservation_t *batch, size_t count, user_t user)
+{
+  time_t end;
+  uint64_t order;
+  size_t i;
+  int status, durable;
+
+  if (count == 0)
+    return 1;
+  qsort(batch, count, sizeof(reservation_t), reservation_cmp);
+  // the batch must be valid and must not overlap itself
   status = 0;
-  // find any value collisions
-  for (query = reservations; query; query = query->next) {
-    if (reservation.start < query->end && reservation.end > query->start) {
+  end = 0;
+  for (i = 0; i < count && status == 0; i++) {
+    if (batch[i].start >= batch[i].end ||
+        (i > 0 && batch[i].room_id == batch[i-1].room_id &&
+         batch[i].start < end))
       status = 1;
-      break;
-    }
+    if (i == 0 || batch[i].room_id != batch[i-1].room_id ||
+        batch[i].end > end)
+      end = batch[i].end;
   }
-  if (!status) {
-    pthread_rwlock_wrlock(&dblock);
-    // store the new value in the database
-    sprintf(sql,
-            "INSERT INTO reservation (room_id,user_id,start_time,end_time) "
-            "VALUES (%d,%d,%ld,%ld)",
-            reservation.room_id,
-            reservation.user_id,
-            reservation.start,
-            reservation.end);
-    status = sql_exec_quiet(sql);
-    if (status != 0) {
-      syslog(LOG_ERR, sqlite3_errmsg(db));
-    }
-    pthread_rwlock_unlock(&dblock);
-  }
-  switch(user.status) {
-  case 2: // admin
-    pthread_mutex_lock(&_adminlock);
-    admin_c--;
-    if (admin_c == 0)
-      pthread_mutex_unlock(&adminlock);
-    pthread_mutex_unlock(&_adminlock);
-  case 0: // student
-    pthread_mutex_lock(&_studentlock);
-    student_c--;
-    if (student_c == 0)
-      pthread_mutex_unlock(&studentlock);
-    pthread_mutex_unlock(&_studentlock);
-    pthread_mutex_unlock(&adminlock);
-    break;
-  case 1: // faculty
-    pthread_mutex_unlock(&studentlock);
-    pthread_mutex_unlock(&adminlock);
-    break;
+  // the backend checks for conflicts and inserts in one atomic step
+  if (status == 0) {
+    admission_enter(user.status);
+    status = backend->reserve(batch, count, &order);
+    sched_publish(order, SCHED_RESERVED, batch, status == 0 ? count : 0);
+    admission_leave();
+    durable = sched_sync();
+    if (status == 0 && durable != 0)
+      status = -1;
   }
   return status;
 }
 
 
-int sched_remove(int roomid, time_t start, time_t end, user_t user) {
-  char sql[256];
-  sqlite3_stmt *stmt;
+int sched_reserve(reservation_t reservation, user_t user)
+{
+  uint64_t start = stats_now();
+  int status = reserve_batch(&reservation, 1, user);
+
+  stats_record(timed[TIMED_RESERVE], start);
+  if (status == 0)
+    return reservation.id;
+  return status > 0 ? 0 : status;
+}
+
+
+int sched_reserve_batch(const reservation_t *reservations, size_t count,
+                        user_t user)
+{
+  uint64_t start = stats_now();
+  reservation_t *batch;
   int status;
-  int count;
-
-  sprintf(sql, "SELECT reservation.id, reservation.user_id, user.email "
-          "FROM reservation LEFT JOIN user WHERE "
-          "reservation.room_id=%d AND reservation.start_time<=%lu AND reservation.end_time>=%lu",
-          roomid, start, end);
-  pthread_rwlock_rdlock(&dblock);
-  if (SQLITE_OK != sqlite3_prepare(db, sql, strlen(sql) * sizeof(char),
-                                   &stmt, NULL)) {
-    pthread_rwlock_unlock(&dblock);
-    return dbfail();
-  }
-  count = 0;
-  while (SQLITE_ROW == (status = sqlite3_step(stmt))) {
-    if (user.id != sqlite3_column_int(stmt, 1) && user.status != 2)
+
+  batch = malloc((count ? count : 1) * sizeof(reservation_t));
+  memcpy(batch, reservations, count * sizeof(reservation_t));
+  status = reserve_batch(batch, count, user);
+  free(batch);
+  stats_record(timed[TIMED_RESERVE_BATCH], start);
+  return status;
+}
+
+
+/* Makes a single reservation on behalf of its owner */
+static int reserve_for(const reservation_t *reservation, user_t owner)
+{
+  reservation_t made = *reservation;
+  uint64_t order;
+  int status, durable;
+
+  admission_enter(owner.status);
+  status = backend->reserve(&made, 1, &order);
+  sched_publish(order, SCHED_RESERVED, &made, status == 0);
+  admission_leave();
+  durable = sched_sync();
+  return status == 0 && durable != 0 ? -1 : status;
+}
+
+/* As `reserve_for`, for `waitlist_take` */
+static int reserve_waiting(const reservation_t *reservation, void *owner)
+{
+  return reserve_for(reservation, *(const user_t*)owner);
+}
+
+/* Offers a freed window of a room to the waitlist, oldest entry first */
+static void waitlist_grant(int roomid, time_t start, time_t end)
+{
+  wentry_t *entries;
+  size_t count;
+  size_t i;
+  user_t owner;
+
+  count = waitlist_match(roomid, start, end, &entries);
+  for (i = 0; i < count; i++) {
+    owner = sched_user(entries[i].reservation.user_id);
+    // not made if its owner has left the waitlist since the match
+    if (0 != waitlist_take(entries+i, reserve_waiting, &owner))
       continue;
-    email_send((const char*)sqlite3_column_text(stmt, 2),
-               "YOUR RESERVATION HAS BEEN MODIFIED");
-    sprintf(sql, "DELETE FROM reservation WHERE id=%d",
-            sqlite3_column_int(stmt, 0));
-    sqlite3_exec(db, sql, NULL, NULL, NULL);
-    count++;
+    if (owner.id == entries[i].reservation.user_id && owner.email[0])
+      email_send(owner.email, "YOUR WAITLISTED RESERVATION HAS BEEN MADE");
   }
-  if (SQLITE_DONE != status) {
-    pthread_rwlock_unlock(&dblock);
-    return dbfail();
+  free(entries);
+}
+
+
+/* Follows up on reservations the backend has deleted, once published */
+static void sched_removed(const reservation_t *removed, ssize_t count)
+{
+  ssize_t i;
+  user_t owner;
+
+  for (i = 0; i < count; i++) {
+    owner = sched_user(removed[i].user_id);
+    if (owner.id == removed[i].user_id && owner.email[0])
+      email_send(owner.email, "YOUR RESERVATION HAS BEEN MODIFIED");
+  }
+  // the freed windows go to whoever has been waiting for them
+  for (i = 0; i < count; i++)
+    waitlist_grant(removed[i].room_id, removed[i].start, removed[i].end);
+}
+
+
+int sched_remove(int roomid, time_t start, time_t end, user_t user) {
+  uint64_t began = stats_now();
+  reservation_t *removed;
+  uint64_t order;
+  ssize_t count;
+  int durable;
+
+  admission_enter(user.status);
+  count = backend->remove(roomid, start, end,
+                          user.status == 2 ? -1 : user.id, &removed, &order);
+  sched_publish(order, SCHED_REMOVED, removed, count);
+  admission_leave();
+  durable = sched_sync();
+  if (count >= 0) {
+    sched_removed(removed, count);
+    free(removed);
   }
-  sqlite3_finalize(stmt);
-  pthread_rwlock_unlock(&dblock);
+  stats_record(timed[TIMED_REMOVE], began);
+  return count < 0 || durable != 0 ? -1 : count;
+}
+
+
+int sched_remove_id(int id, user_t user)
+{
+  uint64_t start = stats_now();
+  reservation_t reservation;
+  uint64_t order;
+  int status = 1;
+  int durable;
+
+  // the index says where the reservation is stored, and whose it is
+  if (0 == uindex_find(id, &reservation) &&
+      (user.status == 2 || reservation.user_id == user.id)) {
+    admission_enter(user.status);
+    status = backend->remove_id(&reservation, &order);
+    sched_publish(order, SCHED_REMOVED, &reservation, status == 0);
+    admission_leave();
+    durable = sched_sync();
+    if (status == 0)
+      sched_removed(&reservation, 1);
+    if (status == 0 && durable != 0)
+      status = -1;
+  }
+  stats_record(timed[TIMED_REMOVE_ID], start);
+  return status;
+}
+
+
+/* As `sched_waitlist`, untimed */
+static int waitlist_join(reservation_t reservation, user_t user)
+{
+  wentry_t entry;
+  room_t room;
+  int status;
+
+  if (reservation.start >= reservation.end ||
+      0 != backend->room(reservation.room_id, &room))
+    return -1;
+  // only a conflict is worth waiting out, and only until the window is over
+  if (0 != (status = sched_reserve(reservation, user)))
+    return status > 0 ? 0 : status;
+  if (reservation.end <= time(NULL))
+    return -1;
+  entry.reservation = reservation;
+  entry.seq = waitlist_add(&reservation);
+  // the window may have been freed between the refusal and the queueing
+  if (0 < (status = reserve_for(&reservation, user)))
+    return 1;
+  // already granted if the entry is gone
+  if (0 != waitlist_drop(&entry))
+    return 0;
+  return status;
+}
+
+
+int sched_waitlist(reservation_t reservation, user_t user)
+{
+  uint64_t start = stats_now();
+  int status = waitlist_join(reservation, user);
+
+  stats_record(timed[TIMED_WAITLIST], start);
+  return status;
+}
+
+
+int sched_waitlist_cancel(int roomid, time_t at, user_t user)
+{
+  return waitlist_cancel(roomid, at, user.status == 2 ? -1 : user.id);
+}
+
+
+ssize_t sched_waitlist_user(int user, reservation_t **reservations)
+{
+  wentry_t *entries;
+  size_t count;
+  size_t i;
+
+  count = waitlist_user(user, &entries);
+  *reservations = count ? malloc(count * sizeof(reservation_t)) : NULL;
+  for (i = 0; i < count; i++)
+    (*reservations)[i] = entries[i].reservation;
+  free(entries);
+  link_reservations(*reservations, count);
   return count;
 }
+
+
+int sched_watch(int room, sched_notify_t notify, void (*release)(void *),
+                void *ctx)
+{
+  room_t r;
+
+  if (0 != backend->room(room, &r))
+    return -1;
+  return feed_watch(room, notify, release, ctx);
+}
+
+
+int sched_unwatch(int room, const void *ctx)
+{
+  return feed_unwatch(room, ctx);
+}
+
+
+void sched_usage_room(int room, time_t day, usage_t *usage)
+{
+  uint64_t start = stats_now();
+
+  usage_room(room, day, usage);
+  stats_record(timed[TIMED_USAGE_ROOM], start);
+}
+
+
+void sched_usage_user(int user, time_t *booked, time_t *count)
+{
+  uint64_t start = stats_now();
+
+  usage_user(user, booked, count);
+  stats_record(timed[TIMED_USAGE_USER], start);
+}
+
+
+int sched_export(int fd, int format)
+{
+  uint64_t start = stats_now();
+  int status = backend->export(fd, format);
+
+  stats_record(timed[TIMED_EXPORT], start);
+  return status;
+}
+
+
+ssize_t sched_history_room(int room, reservation_t **reservations)
+{
+  uint64_t start = stats_now();
+  ssize_t count = backend->history_room(room, reservations);
+
+  link_reservations(*reservations, count);
+  stats_record(timed[TIMED_HISTORY_ROOM], start);
+  return count;
+}
+
+
+ssize_t sched_history_user(int user, reservation_t **reservations)
+{
+  uint64_t start = stats_now();
+  ssize_t count = backend->history_user(user, reservations);
+
+  link_reservations(*reservations, count);
+  stats_record(timed[TIMED_HISTORY_USER], start);
+  return count;
+}
+
+
+ssize_t sched_archive(time_t before)
+{
+  ssize_t count = backend->archive(before);
+  if (count > 0)
+    uindex_archive(before);
+  return count;
+}
+
+
+static void *archive_main(void *_)
+{
+  ssize_t count;
+
+  while (1) {
+    count = sched_archive(time(NULL) - archive_horizon);
+    if (count < 0)
+      syslog(LOG_ERR, "archiving reservations failed");
+    else if (count > 0)
+      syslog(LOG_INFO, "archived %ld reservations", (long)count);
+    sleep(ARCHIVE_INTERVAL);
+  }
+  return NULL;
+}
+
+int sched_archiver(time_t horizon)
+{
+  archive_horizon = horizon;
+  if (0 != pthread_create(&archive_thread, NULL, archive_main, NULL))
+    return -1;
+  return pthread_detach(archive_thread);
+}
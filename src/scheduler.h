@@ -1,9 +1,17 @@
 #ifndef _SCHEDULER_H
 #define _SCHEDULER_H
 
+#include <sys/types.h>
 #include <time.h>
 
 
+#define SCHED_EXPORT_CSV 0
+#define SCHED_EXPORT_JSON 1
+
+#define SCHED_RESERVED 0
+#define SCHED_REMOVED 1
+
+
 typedef struct user_s {
   int id;
   int status;
@@ -12,6 +20,7 @@ typedef struct user_s {
 
 typedef struct reservation_s {
   struct reservation_s *next;
+  int id;
   int room_id;
   int user_id;
   time_t start;
@@ -26,6 +35,29 @@ typedef struct room_s {
   char note[128];
 } room_t;
 
+/* Time booked in a room, in seconds */
+typedef struct usage_s {
+  time_t day;             /* on a given day */
+  time_t week;            /* in the week (from Monday) holding that day */
+  time_t hours[7 * 24];   /* in each hour of the week, Monday 00:00 first,
+                             over every week on record */
+} usage_t;
+
+/* Told of a change (SCHED_RESERVED or SCHED_REMOVED) to a watched room */
+typedef int (*sched_notify_t)(void *ctx, int change,
+                              const reservation_t *reservation);
+
+
+/**
+ * @brief Selects the storage backend used by the scheduling system
+ * Must be called before `sched_load`.  "sqlite" (the default) stores
+ * everything in the database; "memory" seeds itself from the database and
+ * keeps all changes in memory only; "journal" keeps everything in memory and
+ * makes changes durable through an append-only journal next to the database.
+ * @param name The backend's name
+ * @return 0 on success, non-zero if there is no such backend
+ */
+int sched_backend(const char *name);
 
 /**
  * @brief Initializes the scheduling system by loading from the database
@@ -50,16 +82,80 @@ room_t sched_room(int id);
  */
 ssize_t sched_rooms(room_t *rooms);
 
+/**
+ * @brief A number that changes whenever any room is added, changed or removed
+ * @return The version, or negative if it cannot be read (so anything made
+ *         from the rooms should be made again)
+ */
+long sched_rooms_version(void);
+
 ssize_t sched_reservations_room(int room, reservation_t *reservations);
 
 ssize_t sched_reservations_user(int user, reservation_t *reservations);
 
+/**
+ * @brief Reads a room's reservations a page at a time, in order of start
+ * Each page picks up after the last reservation of the one before, so
+ * changes in between do not shift it.
+ * @param after The last reservation of the previous page, or NULL for the
+ *        first page
+ * @param reservations An array of size >= max
+ * @return The number of reservations in the page, 0 after the last one,
+ *         negative on failure
+ */
+ssize_t sched_page_room(int room, const reservation_t *after,
+                        reservation_t *reservations, size_t max);
+
+/**
+ * @brief As `sched_page_room`, for a user's reservations
+ */
+ssize_t sched_page_user(int user, const reservation_t *after,
+                        reservation_t *reservations, size_t max);
+
 /**
  * @brief Attempts to place a reservation into the system
- * @return 0 if the reservation was added successfully, otherwise non-zero
+ * @return The new reservation's id (positive) if it was added, 0 if it
+ *         conflicts with another or is invalid, negative on failure
  */
 int sched_reserve(reservation_t reservation, user_t user);
 
+/**
+ * @brief Attempts to place several reservations at once
+ * Either every reservation is added or, if any of them is invalid or
+ * conflicts with an existing reservation or another one in the batch,
+ * none are.
+ * @return 0 if all of the reservations were added, otherwise non-zero
+ */
+int sched_reserve_batch(const reservation_t *reservations, size_t count,
+                        user_t user);
+
+/**
+ * @brief Reserves a room, or waits in line for it if it is taken
+ * A waiting reservation is made as soon as a removal frees its window,
+ * and its owner is notified by email.
+ * Only a conflict is waited out; waiting entries are dropped once their
+ * window is over.
+ * @return 0 if the reservation was added right away, 1 if it is waiting,
+ *         negative if it can never be made (no such room, empty window,
+ *         taken and already over) or on failure
+ */
+int sched_waitlist(reservation_t reservation, user_t user);
+
+/**
+ * @brief Leaves the waitlists of a room for windows that include a time
+ * Only the user's own entries are removed, or everyone's for an admin.
+ * @return The number of entries removed
+ */
+int sched_waitlist_cancel(int roomid, time_t at, user_t user);
+
+/**
+ * @brief Lists the reservations a user is waiting for, oldest first
+ * They are copied out in one go into a malloc'd array returned through
+ * `reservations`, for the caller to free.
+ * @return The number of reservations
+ */
+ssize_t sched_waitlist_user(int user, reservation_t **reservations);
+
 /**
  * @brief Attempts to remote room reservations that occupy a time block
  * Rooms will only be removed if owned by the user or
@@ -68,5 +164,80 @@ int sched_reserve(reservation_t reservation, user_t user);
  */
 int sched_remove(int roomid, time_t start, time_t end, user_t user);
 
+/**
+ * @brief Removes a reservation by its id
+ * Only the owner or an admin may remove it.
+ * @return 0 if it was removed, 1 if there is no such reservation (of the
+ *         user's), negative on failure
+ */
+int sched_remove_id(int id, user_t user);
+
+/**
+ * @brief Subscribes `ctx` to every reservation made in or removed from a room
+ * `notify` runs on a separate feed thread, once per change in the order
+ * they were made, and must not block; returning non-zero unsubscribes.
+ * `release` is called once the subscription is gone and `ctx` is unused.
+ * @return 0 on success, 1 if already subscribed, negative if no such room
+ */
+int sched_watch(int room, sched_notify_t notify, void (*release)(void *),
+                void *ctx);
+
+/**
+ * @brief Unsubscribes `ctx` from a room, or from every room if negative
+ * @return The number of subscriptions cancelled
+ */
+int sched_unwatch(int room, const void *ctx);
+
+
+/**
+ * @brief Reads the time booked in a room around a day, in local time
+ * The totals are kept up to date as reservations are made and removed,
+ * so reading them does not depend on the number of reservations.
+ */
+void sched_usage_room(int room, time_t day, usage_t *usage);
+
+/**
+ * @brief Reads the total time a user has booked and in how many reservations
+ * Archived reservations are included in this and `sched_usage_room`.
+ */
+void sched_usage_user(int user, time_t *booked, time_t *count);
+
+
+/**
+ * @brief Reads the archived reservations of a room or user, by start time
+ * Archived reservations are kept apart from current ones so that they cost
+ * nothing to queries and conflict checks; these read them on demand.
+ * They are read in one go, so archiving cannot change them midway, into a
+ * malloc'd array returned through `reservations` for the caller to free.
+ * @return The number of archived reservations, negative on failure
+ */
+ssize_t sched_history_room(int room, reservation_t **reservations);
+
+ssize_t sched_history_user(int user, reservation_t **reservations);
+
+/**
+ * @brief Moves every reservation that ended before a time into the history
+ * @return The number of reservations archived, negative on failure
+ */
+ssize_t sched_archive(time_t before);
+
+/**
+ * @brief Starts a background thread archiving reservations as they age
+ * Every ARCHIVE_INTERVAL seconds, reservations that ended more than
+ * `horizon` seconds ago are moved into the history.
+ * @return 0 on success
+ */
+int sched_archiver(time_t horizon);
+
+/**
+ * @brief Streams every reservation, joined with its user and room, to a file
+ * The export reads from its own snapshot, taken all at once, so it does
+ * not block reservations made while it runs.  Rows are in order of id.
+ * @param fd The file descriptor to write to
+ * @param format SCHED_EXPORT_CSV or SCHED_EXPORT_JSON (newline-delimited)
+ * @return 0 on success
+ */
+int sched_export(int fd, int format);
+
 
 #endif
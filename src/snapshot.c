@@ -0,0 +1,242 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+
+#define SNAPSHOT_MAGIC "SCHDSNAP"
+#define SNAPSHOT_VERSION 4
+#define SNAPSHOT_ENDIAN 0x01020304
+#define SNAPSHOT_ALIGN 64
+
+/* Every section is addressed by its offset from the start of the file, so
+ * the mapping can land anywhere. */
+typedef struct sheader_s {
+  char magic[8];
+  uint32_t version;
+  uint32_t endian;
+  uint32_t room_size;
+  uint32_t user_size;
+  uint32_t res_size;
+  uint32_t pad;
+  uint64_t generation;
+  int64_t next_id;
+  uint64_t room_c;
+  uint64_t user_c;
+  uint64_t res_c;
+  uint64_t hres_c;
+  uint64_t room_off;
+  uint64_t user_off;
+  uint64_t index_off;
+  uint64_t start_off;
+  uint64_t end_off;
+  uint64_t id_off;
+  uint64_t owner_off;
+  uint64_t hindex_off;
+  uint64_t hres_off;
+  uint64_t size;
+} sheader_t;
+
+
+static uint64_t snapshot_align(uint64_t off)
+{ return (off + SNAPSHOT_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_ALIGN - 1); }
+
+static int snapshot_section(FILE *f, uint64_t off, const void *data,
+                            size_t size, size_t count)
+{
+  static const char zero[SNAPSHOT_ALIGN];
+  long at = ftell(f);
+
+  if (at < 0 || (uint64_t)at > off ||
+      off - at != fwrite(zero, 1, off - at, f))
+    return -1;
+  return count == fwrite(data, size, count, f) ? 0 : -1;
+}
+
+
+/* Whether `count` items of `size` bytes at `off` lie within a file of
+ * `file` bytes, without overflowing */
+static int snapshot_fits(uint64_t off, uint64_t count, size_t size,
+                         uint64_t file)
+{
+  return off <= file && count <= (file - off) / size;
+}
+
+/* Whether every room's entry in `index` names that room and lies within
+ * the `res_c` reservations it indexes */
+static int snapshot_index_ok(const sindex_t *index, const room_t *rooms,
+                             uint64_t room_c, uint64_t res_c)
+{
+  uint64_t i;
+
+  for (i = 0; i < room_c; i++)
+    if (index[i].room_id != rooms[i].id || index[i].first > res_c ||
+        index[i].count > res_c - index[i].first)
+      return 0;
+  return 1;
+}
+
+
+int snapshot_map(const char *path, snapshot_t *snapshot)
+{
+  const sheader_t *header;
+  struct stat st;
+  const char *map;
+  int fd;
+
+  if (0 > (fd = open(path, O_RDONLY)))
+    return -1;
+  if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(sheader_t)) {
+    close(fd);
+    return -1;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+  header = (const sheader_t*)map;
+  if (0 != memcmp(header->magic, SNAPSHOT_MAGIC, 8) ||
+      header->version != SNAPSHOT_VERSION ||
+      header->endian != SNAPSHOT_ENDIAN ||
+      header->room_size != sizeof(room_t) ||
+      header->user_size != sizeof(user_t) ||
+      header->res_size != sizeof(sres_t) ||
+      header->size != (uint64_t)st.st_size ||
+      !snapshot_fits(header->room_off, header->room_c,
+                     sizeof(room_t), header->size) ||
+      !snapshot_fits(header->user_off, header->user_c,
+                     sizeof(user_t), header->size) ||
+      !snapshot_fits(header->index_off, header->room_c,
+                     sizeof(sindex_t), header->size) ||
+      !snapshot_fits(header->start_off, header->res_c,
+                     sizeof(int64_t), header->size) ||
+      !snapshot_fits(header->end_off, header->res_c,
+                     sizeof(int64_t), header->size) ||
+      !snapshot_fits(header->id_off, header->res_c,
+                     sizeof(int32_t), header->size) ||
+      !snapshot_fits(header->owner_off, header->res_c,
+                     sizeof(int32_t), header->size) ||
+      !snapshot_fits(header->hindex_off, header->room_c,
+                     sizeof(sindex_t), header->size) ||
+      !snapshot_fits(header->hres_off, header->hres_c,
+                     sizeof(sres_t), header->size) ||
+      !snapshot_index_ok((const sindex_t*)(map + header->index_off),
+                         (const room_t*)(map + header->room_off),
+                         header->room_c, header->res_c) ||
+      !snapshot_index_ok((const sindex_t*)(map + header->hindex_off),
+                         (const room_t*)(map + header->room_off),
+                         header->room_c, header->hres_c)) {
+    syslog(LOG_WARNING, "snapshot %s is not usable", path);
+    munmap((void*)map, st.st_size);
+    return -1;
+  }
+  snapshot->generation = header->generation;
+  snapshot->next_id = header->next_id;
+  snapshot->rooms = (const room_t*)(map + header->room_off);
+  snapshot->room_c = header->room_c;
+  snapshot->users = (const user_t*)(map + header->user_off);
+  snapshot->user_c = header->user_c;
+  snapshot->index = (const sindex_t*)(map + header->index_off);
+  snapshot->res_start = (const int64_t*)(map + header->start_off);
+  snapshot->res_end = (const int64_t*)(map + header->end_off);
+  snapshot->res_id = (const int32_t*)(map + header->id_off);
+  snapshot->res_user = (const int32_t*)(map + header->owner_off);
+  snapshot->res_c = header->res_c;
+  snapshot->hindex = (const sindex_t*)(map + header->hindex_off);
+  snapshot->hres = (const sres_t*)(map + header->hres_off);
+  snapshot->hres_c = header->hres_c;
+  snapshot->map = map;
+  snapshot->map_size = st.st_size;
+  return 0;
+}
+
+void snapshot_unmap(const snapshot_t *snapshot)
+{
+  munmap((void*)snapshot->map, snapshot->map_size);
+}
+
+
+int snapshot_write(const char *path, const snapshot_t *snapshot)
+{
+  sheader_t header;
+  char *tmp;
+  FILE *f;
+  int status;
+
+  memset(&header, 0, sizeof(sheader_t));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+  header.version = SNAPSHOT_VERSION;
+  header.endian = SNAPSHOT_ENDIAN;
+  header.room_size = sizeof(room_t);
+  header.user_size = sizeof(user_t);
+  header.res_size = sizeof(sres_t);
+  header.generation = snapshot->generation;
+  header.next_id = snapshot->next_id;
+  header.room_c = snapshot->room_c;
+  header.user_c = snapshot->user_c;
+  header.res_c = snapshot->res_c;
+  header.hres_c = snapshot->hres_c;
+  header.room_off = snapshot_align(sizeof(sheader_t));
+  header.user_off = snapshot_align(header.room_off +
+                                   header.room_c * sizeof(room_t));
+  header.index_off = snapshot_align(header.user_off +
+                                    header.user_c * sizeof(user_t));
+  header.start_off = snapshot_align(header.index_off +
+                                    header.room_c * sizeof(sindex_t));
+  header.end_off = snapshot_align(header.start_off +
+                                  header.res_c * sizeof(int64_t));
+  header.id_off = snapshot_align(header.end_off +
+                                 header.res_c * sizeof(int64_t));
+  header.owner_off = snapshot_align(header.id_off +
+                                       header.res_c * sizeof(int32_t));
+  header.hindex_off = snapshot_align(header.owner_off +
+                                     header.res_c * sizeof(int32_t));
+  header.hres_off = snapshot_align(header.hindex_off +
+                                   header.room_c * sizeof(sindex_t));
+  header.size = header.hres_off + header.hres_c * sizeof(sres_t);
+
+  tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+  if (!(f = fopen(tmp, "wb"))) {
+    free(tmp);
+    return -1;
+  }
+  status = 0;
+  if (1 != fwrite(&header, sizeof(sheader_t), 1, f) ||
+      0 != snapshot_section(f, header.room_off, snapshot->rooms,
+                            sizeof(room_t), snapshot->room_c) ||
+      0 != snapshot_section(f, header.user_off, snapshot->users,
+                            sizeof(user_t), snapshot->user_c) ||
+      0 != snapshot_section(f, header.index_off, snapshot->index,
+                            sizeof(sindex_t), snapshot->room_c) ||
+      0 != snapshot_section(f, header.start_off, snapshot->res_start,
+                            sizeof(int64_t), snapshot->res_c) ||
+      0 != snapshot_section(f, header.end_off, snapshot->res_end,
+                            sizeof(int64_t), snapshot->res_c) ||
+      0 != snapshot_section(f, header.id_off, snapshot->res_id,
+                            sizeof(int32_t), snapshot->res_c) ||
+      0 != snapshot_section(f, header.owner_off, snapshot->res_user,
+                            sizeof(int32_t), snapshot->res_c) ||
+      0 != snapshot_section(f, header.hindex_off, snapshot->hindex,
+                            sizeof(sindex_t), snapshot->room_c) ||
+      0 != snapshot_section(f, header.hres_off, snapshot->hres,
+                            sizeof(sres_t), snapshot->hres_c) ||
+      0 != fflush(f) || 0 != fsync(fileno(f)))
+    status = -1;
+  if (0 != fclose(f))
+    status = -1;
+  if (status == 0 && 0 != rename(tmp, path))
+    status = -1;
+  if (status != 0) {
+    syslog(LOG_ERR, "snapshot %s could not be written", path);
+    unlink(tmp);
+  }
+  free(tmp);
+  return status;
+}
@@ -0,0 +1,76 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "scheduler.h"
+
+
+/* An archived reservation as stored in a snapshot; the room is implied by
+ * the array it belongs to. */
+typedef struct sres_s {
+  int32_t id;
+  int32_t user_id;
+  int64_t start;
+  int64_t end;
+} sres_t;
+
+/* Locates one room's reservations within the snapshot's arrays */
+typedef struct sindex_s {
+  int32_t room_id;
+  uint32_t pad;
+  uint64_t first;
+  uint64_t count;
+} sindex_t;
+
+/* The contents of a snapshot.
+ * Rooms and users are sorted by id; `index` (current reservations) and
+ * `hindex` (archived reservations) run parallel to `rooms`.
+ * Current reservations are stored as parallel arrays, sorted by start
+ * within each room, so interval scans only touch `res_start`/`res_end`. */
+typedef struct snapshot_s {
+  uint64_t generation;
+  int64_t next_id;
+  const room_t *rooms;
+  size_t room_c;
+  const user_t *users;
+  size_t user_c;
+  const sindex_t *index;
+  const int64_t *res_start;
+  const int64_t *res_end;
+  const int32_t *res_id;
+  const int32_t *res_user;
+  size_t res_c;
+  const sindex_t *hindex;
+  const sres_t *hres;
+  size_t hres_c;
+  const void *map;      /* the mapping, if from `snapshot_map` */
+  size_t map_size;
+} snapshot_t;
+
+
+/**
+ * @brief Maps a snapshot file read-only
+ * The arrays in `snapshot` point straight into the mapping, which stays
+ * valid until `snapshot_unmap` even if the file is later replaced.
+ * @return 0 on success, non-zero if the file is missing, not a snapshot
+ * of this version and platform, or has sections or room indexes that do
+ * not fit within it
+ */
+int snapshot_map(const char *path, snapshot_t *snapshot);
+
+/**
+ * @brief Unmaps a snapshot mapped by `snapshot_map`, once nothing uses it
+ */
+void snapshot_unmap(const snapshot_t *snapshot);
+
+/**
+ * @brief Writes a snapshot file
+ * The file is written beside `path` and renamed over it once synced, so a
+ * crash leaves either the old or the new snapshot.
+ * @return 0 on success
+ */
+int snapshot_write(const char *path, const snapshot_t *snapshot);
+
+#endif
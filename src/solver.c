@@ -0,0 +1,484 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+#include "solver.h"
+#include "timefmt.h"
+
+
+/* A window keeps the text it was given in, so the plan repeats it as is */
+typedef struct window_s {
+  time_t start;
+  time_t end;
+  char text[40];
+} window_t;
+
+typedef struct request_s {
+  char label[64];
+  int seats;
+  window_t *windows;
+  size_t window_c;
+  int *cand;
+  size_t cand_c;
+  int room;
+  unsigned stuck;
+} request_t;
+
+/* An occupied interval of a room; `req` is -1 for existing reservations */
+typedef struct span_s {
+  time_t start;
+  time_t end;
+  int req;
+} span_t;
+
+typedef struct sroom_s {
+  room_t room;
+  span_t *busy;
+  size_t busy_c;
+  span_t *placed;
+  size_t placed_c;
+  size_t placed_cap;
+} sroom_t;
+
+typedef struct solver_s {
+  sroom_t *rooms;
+  size_t room_c;
+  int *order;
+  request_t *reqs;
+  size_t req_c;
+  unsigned version;
+} solver_t;
+
+typedef struct worker_s {
+  solver_t *sv;
+  size_t first;
+  size_t step;
+} worker_t;
+
+
+static int compar_span(const void *a, const void *b)
+{
+  const span_t *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static int compar_window(const void *a, const void *b)
+{
+  const window_t *x = a, *y = b;
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/* The first of `n` disjoint, sorted spans that ends after `start` */
+static size_t span_lower(const span_t *spans, size_t n, time_t start)
+{
+  size_t lo = 0, hi = n, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (spans[mid].end <= start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static int span_hits(const span_t *spans, size_t n, time_t start, time_t end)
+{
+  size_t i = span_lower(spans, n, start);
+  return i < n && spans[i].start < end;
+}
+
+
+/* Loads the rooms and their reservations, merged into disjoint spans */
+static int solver_rooms(solver_t *sv)
+{
+  room_t *rooms;
+  reservation_t *res;
+  ssize_t count, i, j, n;
+  sroom_t *r;
+
+  if (0 > (count = sched_rooms(NULL)))
+    return -1;
+  rooms = malloc((count + 1) * sizeof(room_t));
+  count = sched_rooms(rooms);
+  sv->rooms = calloc(count + 1, sizeof(sroom_t));
+  sv->room_c = count;
+  for (i = 0; i < count; i++) {
+    r = sv->rooms + i;
+    r->room = rooms[i];
+    n = sched_reservations_room(rooms[i].id, NULL);
+    if (n <= 0)
+      continue;
+    res = malloc(n * sizeof(reservation_t));
+    n = sched_reservations_room(rooms[i].id, res);
+    r->busy = malloc(n * sizeof(span_t));
+    for (j = 0; j < n; j++) {
+      r->busy[j].start = res[j].start;
+      r->busy[j].end = res[j].end;
+      r->busy[j].req = -1;
+    }
+    free(res);
+    qsort(r->busy, n, sizeof(span_t), compar_span);
+    r->busy_c = 0;
+    for (j = 0; j < n; j++) {
+      if (r->busy_c && r->busy[j].start < r->busy[r->busy_c-1].end) {
+        if (r->busy[j].end > r->busy[r->busy_c-1].end)
+          r->busy[r->busy_c-1].end = r->busy[j].end;
+      } else {
+        r->busy[r->busy_c++] = r->busy[j];
+      }
+    }
+  }
+  free(rooms);
+  return 0;
+}
+
+/* Best fit first: the smallest room that is large enough */
+static solver_t *order_sv;
+static int compar_room(const void *a, const void *b)
+{
+  const room_t *x = &order_sv->rooms[*(const int*)a].room;
+  const room_t *y = &order_sv->rooms[*(const int*)b].room;
+  if (x->capacity != y->capacity)
+    return x->capacity < y->capacity ? -1 : 1;
+  if (x->sqft != y->sqft)
+    return x->sqft < y->sqft ? -1 : 1;
+  return x->id < y->id ? -1 : x->id > y->id;
+}
+
+
+static int solver_parse(char *line, request_t *req)
+{
+  window_t *windows, *window;
+  char *save;
+  char *tok[5];
+  size_t cap;
+  int i;
+
+  memset(req, 0, sizeof(request_t));
+  req->room = -1;
+  if (!(tok[0] = strtok_r(line, " \t\r\n", &save)) || tok[0][0] == '#')
+    return 1;
+  strncpy(req->label, tok[0], sizeof(req->label) - 1);
+  if (!(tok[0] = strtok_r(NULL, " \t\r\n", &save)) ||
+      0 >= (req->seats = atoi(tok[0])))
+    return -1;
+  cap = 0;
+  while ((tok[0] = strtok_r(NULL, " \t\r\n", &save))) {
+    for (i = 1; i < 4; i++)
+      if (!(tok[i] = strtok_r(NULL, " \t\r\n", &save)))
+        return -1;
+    if (req->window_c == cap) {
+      cap = cap ? cap * 2 : 4;
+      if (!(windows = realloc(req->windows, cap * sizeof(window_t))))
+        return -1;
+      req->windows = windows;
+    }
+    // read as `r` reads them, so the plan books the times it was checked at
+    window = req->windows + req->window_c;
+    if (0 != timefmt_parse(tok[0], tok[1], &window->start) ||
+        0 != timefmt_parse(tok[2], tok[3], &window->end))
+      return -1;
+    snprintf(window->text, sizeof(window->text),
+             "%.10s %.5s %.10s %.5s", tok[0], tok[1], tok[2], tok[3]);
+    if (window->start >= window->end)
+      return -1;
+    req->window_c++;
+  }
+  // a request's own windows must not overlap each other
+  qsort(req->windows, req->window_c, sizeof(window_t), compar_window);
+  for (i = 1; i < (int)req->window_c; i++)
+    if (req->windows[i].start < req->windows[i-1].end)
+      return -1;
+  return req->window_c ? 0 : -1;
+}
+
+static int solver_requests(solver_t *sv, FILE *in)
+{
+  char line[4096];
+  size_t cap;
+  size_t lineno;
+  int status;
+
+  cap = 0;
+  lineno = 0;
+  while (fgets(line, sizeof(line), in)) {
+    lineno++;
+    if (sv->req_c == cap) {
+      cap = cap ? cap * 2 : 256;
+      sv->reqs = realloc(sv->reqs, cap * sizeof(request_t));
+    }
+    status = solver_parse(line, sv->reqs + sv->req_c);
+    if (status == 0) {
+      sv->req_c++;
+      continue;
+    }
+    free(sv->reqs[sv->req_c].windows);
+    if (status < 0)
+      fprintf(stderr, "line %lu: bad request\n", (unsigned long)lineno);
+  }
+  return ferror(in) ? -1 : 0;
+}
+
+
+/* Finds the rooms each request could use if it were the only one */
+static void *solver_worker(void *arg)
+{
+  worker_t *w = arg;
+  solver_t *sv = w->sv;
+  request_t *req;
+  sroom_t *room;
+  size_t i, j, k;
+
+  for (i = w->first; i < sv->req_c; i += w->step) {
+    req = sv->reqs + i;
+    req->cand = malloc(sv->room_c * sizeof(int) + 1);
+    for (j = 0; j < sv->room_c; j++) {
+      room = sv->rooms + sv->order[j];
+      if (room->room.capacity < req->seats)
+        continue;
+      for (k = 0; k < req->window_c; k++)
+        if (span_hits(room->busy, room->busy_c,
+                      req->windows[k].start, req->windows[k].end))
+          break;
+      if (k == req->window_c)
+        req->cand[req->cand_c++] = sv->order[j];
+    }
+  }
+  return NULL;
+}
+
+static void solver_candidates(solver_t *sv)
+{
+  pthread_t *threads;
+  worker_t *workers;
+  char *started;
+  long n, i;
+
+  n = SOLVER_THREADS > 0 ? SOLVER_THREADS : sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1)
+    n = 1;
+  threads = malloc(n * sizeof(pthread_t));
+  workers = malloc(n * sizeof(worker_t));
+  started = malloc(n);
+  for (i = 0; i < n; i++) {
+    workers[i].sv = sv;
+    workers[i].first = i;
+    workers[i].step = n;
+    started[i] = 0 == pthread_create(threads+i, NULL, solver_worker,
+                                     workers+i);
+    // no thread to spare: do this share here
+    if (!started[i])
+      solver_worker(workers+i);
+  }
+  for (i = 0; i < n; i++)
+    if (started[i])
+      pthread_join(threads[i], NULL);
+  free(threads);
+  free(workers);
+  free(started);
+}
+
+
+static int solver_fits(const solver_t *sv, const request_t *req, int room)
+{
+  const sroom_t *r = sv->rooms + room;
+  size_t k;
+
+  for (k = 0; k < req->window_c; k++)
+    if (span_hits(r->placed, r->placed_c,
+                  req->windows[k].start, req->windows[k].end))
+      return 0;
+  return 1;
+}
+
+static void solver_place(solver_t *sv, int reqi, int room)
+{
+  request_t *req = sv->reqs + reqi;
+  sroom_t *r = sv->rooms + room;
+  size_t k, at;
+
+  for (k = 0; k < req->window_c; k++) {
+    if (r->placed_c == r->placed_cap) {
+      r->placed_cap = r->placed_cap ? r->placed_cap * 2 : 16;
+      r->placed = realloc(r->placed, r->placed_cap * sizeof(span_t));
+    }
+    at = span_lower(r->placed, r->placed_c, req->windows[k].start);
+    memmove(r->placed+at+1, r->placed+at, (r->placed_c-at) * sizeof(span_t));
+    r->placed[at].start = req->windows[k].start;
+    r->placed[at].end = req->windows[k].end;
+    r->placed[at].req = reqi;
+    r->placed_c++;
+  }
+  req->room = room;
+}
+
+static void solver_unplace(solver_t *sv, int reqi)
+{
+  request_t *req = sv->reqs + reqi;
+  sroom_t *r = sv->rooms + req->room;
+  size_t k, at;
+
+  for (k = 0; k < req->window_c; k++) {
+    at = span_lower(r->placed, r->placed_c, req->windows[k].start);
+    if (at < r->placed_c && r->placed[at].req == reqi) {
+      r->placed_c--;
+      memmove(r->placed+at, r->placed+at+1,
+              (r->placed_c-at) * sizeof(span_t));
+    }
+  }
+  req->room = -1;
+}
+
+/* The only placed request in `room` in the way of `req`, -1 if there is
+ * none and -2 if there are several */
+static int solver_blocker(const solver_t *sv, const request_t *req, int room)
+{
+  const sroom_t *r = sv->rooms + room;
+  size_t i, k;
+  int found = -1;
+
+  for (k = 0; k < req->window_c; k++) {
+    for (i = span_lower(r->placed, r->placed_c, req->windows[k].start);
+         i < r->placed_c && r->placed[i].start < req->windows[k].end; i++) {
+      if (found >= 0 && r->placed[i].req != found)
+        return -2;
+      found = r->placed[i].req;
+    }
+  }
+  return found;
+}
+
+
+/* Hardest first: fewest rooms to choose from, then most seats, then the
+ * most windows */
+static int compar_difficulty(const void *a, const void *b)
+{
+  const request_t *x = order_sv->reqs + *(const int*)a;
+  const request_t *y = order_sv->reqs + *(const int*)b;
+  if (x->cand_c != y->cand_c)
+    return x->cand_c < y->cand_c ? -1 : 1;
+  if (x->seats != y->seats)
+    return x->seats > y->seats ? -1 : 1;
+  if (x->window_c != y->window_c)
+    return x->window_c > y->window_c ? -1 : 1;
+  return *(const int*)a - *(const int*)b;
+}
+
+static void solver_greedy(solver_t *sv, const int *order)
+{
+  request_t *req;
+  size_t i, j;
+
+  for (i = 0; i < sv->req_c; i++) {
+    req = sv->reqs + order[i];
+    for (j = 0; j < req->cand_c; j++) {
+      if (solver_fits(sv, req, req->cand[j])) {
+        solver_place(sv, order[i], req->cand[j]);
+        break;
+      }
+    }
+  }
+}
+
+/* Places a left-out request by moving the one request in its way to
+ * another of that request's rooms.  The blocker is not in the way of its
+ * other rooms, so nothing has to change until a move is found. */
+static int solver_eject(solver_t *sv, int reqi)
+{
+  request_t *req = sv->reqs + reqi;
+  request_t *other;
+  size_t j, k;
+  int blocker, room;
+
+  for (j = 0; j < req->cand_c; j++) {
+    room = req->cand[j];
+    if (0 > (blocker = solver_blocker(sv, req, room)))
+      continue;
+    other = sv->reqs + blocker;
+    // nothing has moved since this one was last found to have nowhere to go
+    if (other->stuck == sv->version + 1)
+      continue;
+    for (k = 0; k < other->cand_c; k++) {
+      if (other->cand[k] != room && solver_fits(sv, other, other->cand[k])) {
+        solver_unplace(sv, blocker);
+        solver_place(sv, blocker, other->cand[k]);
+        solver_place(sv, reqi, room);
+        sv->version++;
+        return 1;
+      }
+    }
+    other->stuck = sv->version + 1;
+  }
+  return 0;
+}
+
+
+int solver_run(FILE *in, FILE *out)
+{
+  solver_t sv;
+  int *order;
+  size_t i, j, placed;
+  int pass, moved;
+  request_t *req;
+
+  memset(&sv, 0, sizeof(solver_t));
+  if (0 != solver_rooms(&sv) || 0 != solver_requests(&sv, in))
+    return -1;
+  order_sv = &sv;
+  sv.order = malloc((sv.room_c + 1) * sizeof(int));
+  for (i = 0; i < sv.room_c; i++)
+    sv.order[i] = i;
+  qsort(sv.order, sv.room_c, sizeof(int), compar_room);
+  solver_candidates(&sv);
+
+  order = malloc((sv.req_c + 1) * sizeof(int));
+  for (i = 0; i < sv.req_c; i++)
+    order[i] = i;
+  qsort(order, sv.req_c, sizeof(int), compar_difficulty);
+  solver_greedy(&sv, order);
+  for (pass = 0; pass < SOLVER_PASSES; pass++) {
+    moved = 0;
+    for (i = 0; i < sv.req_c; i++)
+      if (sv.reqs[order[i]].room < 0)
+        moved += solver_eject(&sv, order[i]);
+    if (!moved)
+      break;
+  }
+
+  placed = 0;
+  for (i = 0; i < sv.req_c; i++) {
+    req = sv.reqs + i;
+    if (req->room < 0)
+      continue;
+    placed++;
+    fprintf(out, "# %s\n", req->label);
+    for (j = 0; j < req->window_c; j++)
+      fprintf(out, "r %d %s\n", sv.rooms[req->room].room.id,
+              req->windows[j].text);
+  }
+  for (i = 0; i < sv.req_c; i++)
+    if (sv.reqs[i].room < 0)
+      fprintf(out, "# unplaced %s\n", sv.reqs[i].label);
+  fprintf(out, "# placed %lu of %lu\n",
+          (unsigned long)placed, (unsigned long)sv.req_c);
+
+  for (i = 0; i < sv.req_c; i++) {
+    free(sv.reqs[i].windows);
+    free(sv.reqs[i].cand);
+  }
+  for (i = 0; i < sv.room_c; i++) {
+    free(sv.rooms[i].busy);
+    free(sv.rooms[i].placed);
+  }
+  free(sv.reqs);
+  free(sv.rooms);
+  free(sv.order);
+  free(order);
+  return sv.req_c - placed;
+}
@@ -0,0 +1,30 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stdio.h>
+
+/* Threads used to find the rooms each request fits; 0 means one per CPU */
+#ifndef SOLVER_THREADS
+#define SOLVER_THREADS 0
+#endif
+
+/* Rounds of local search over the requests the greedy pass left out */
+#ifndef SOLVER_PASSES
+#define SOLVER_PASSES 4
+#endif
+
+
+/**
+ * @brief Assigns rooms to a batch of requests read from `in`
+ * Each line of `in` is a request:
+ *   LABEL SEATS YYYY-MM-DD hh:mm YYYY-MM-DD hh:mm [YYYY-MM-DD hh:mm ...]
+ * that needs one room with at least SEATS capacity for all of its windows.
+ * Rooms are taken from the scheduler along with their current reservations.
+ * The plan is written to `out` as one `r` command per window, each request
+ * headed by a `# LABEL` comment; requests that could not be placed are
+ * listed as `# unplaced LABEL`.
+ * @return The number of requests left unplaced, negative on failure
+ */
+int solver_run(FILE *in, FILE *out);
+
+#endif
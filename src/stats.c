@@ -0,0 +1,238 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "stats.h"
+
+/* Buckets per power of two (as a power of two), and the powers of two of
+ * ticks covered; longer times share the last bucket */
+#define STATS_SUB_BITS 3
+#define STATS_BITS 40
+#define STATS_BUCKETS ((STATS_BITS - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+
+
+/* A thread's samples; its buckets for an operation are allocated on its
+ * first sample of it.  Only the thread writes them, and readers take them
+ * as they are at the time, so counting needs no atomic read-modify-write. */
+typedef struct sthread_s {
+  struct sthread_s *next;
+  uint32_t *counts[STATS_MAX];
+  uint64_t max[STATS_MAX];
+} sthread_t;
+
+static const char *names[STATS_MAX];
+static int name_c = 1;
+// the threads still running, and what the finished ones recorded
+static sthread_t *threads = NULL;
+static uint64_t retired[STATS_MAX][STATS_BUCKETS];
+static uint64_t retired_max[STATS_MAX];
+static pthread_mutex_t statslock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t statskey;
+static pthread_once_t statsonce = PTHREAD_ONCE_INIT;
+static __thread sthread_t *mine = NULL;
+// when the first operation was registered, to convert ticks by
+static uint64_t tick0;
+static struct timespec time0;
+
+
+static uint64_t stats_ns(const struct timespec *ts)
+{
+  return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+uint64_t stats_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return stats_ns(&now);
+#endif
+}
+
+
+/* The bucket of a number of ticks: exact below 2^STATS_SUB_BITS, then
+ * 2^STATS_SUB_BITS buckets for each power of two */
+static size_t stats_bucket(uint64_t ticks)
+{
+  int bits;
+
+  if (ticks < (1 << STATS_SUB_BITS))
+    return ticks;
+  bits = 63 - __builtin_clzll(ticks);
+  if (bits >= STATS_BITS)
+    return STATS_BUCKETS - 1;
+  return ((bits - STATS_SUB_BITS + 1) << STATS_SUB_BITS) +
+    ((ticks >> (bits - STATS_SUB_BITS)) & ((1 << STATS_SUB_BITS) - 1));
+}
+
+/* The most ticks that fall in a bucket */
+static uint64_t stats_bucket_top(size_t bucket)
+{
+  uint64_t sub = bucket & ((1 << STATS_SUB_BITS) - 1);
+  int shift;
+
+  if (bucket < (1 << STATS_SUB_BITS))
+    return bucket;
+  shift = (bucket >> STATS_SUB_BITS) - 1;
+  return (((1 << STATS_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+
+/* Folds a finished thread's samples into the retired ones */
+static void stats_retire(void *_)
+{
+  sthread_t *thread = _, **p;
+  uint32_t *counts;
+  size_t i, j;
+
+  pthread_mutex_lock(&statslock);
+  for (p = &threads; *p != thread; p = &(*p)->next);
+  *p = thread->next;
+  for (i = 0; i < STATS_MAX; i++) {
+    if (!(counts = thread->counts[i]))
+      continue;
+    for (j = 0; j < STATS_BUCKETS; j++)
+      retired[i][j] += counts[j];
+    if (thread->max[i] > retired_max[i])
+      retired_max[i] = thread->max[i];
+    free(counts);
+  }
+  pthread_mutex_unlock(&statslock);
+  free(thread);
+}
+
+static void stats_init(void)
+{
+  pthread_key_create(&statskey, stats_retire);
+  tick0 = stats_now();
+  clock_gettime(CLOCK_MONOTONIC, &time0);
+}
+
+
+int stats_metric(const char *name)
+{
+  int id;
+
+  pthread_once(&statsonce, stats_init);
+  pthread_mutex_lock(&statslock);
+  for (id = 1; id < name_c; id++)
+    if (0 == strcmp(names[id], name))
+      break;
+  if (id == name_c && name_c < STATS_MAX)
+    names[name_c++] = name;
+  pthread_mutex_unlock(&statslock);
+  return id < STATS_MAX ? id : 0;
+}
+
+
+/* The calling thread's first sample of an operation */
+static uint32_t *stats_counts(int metric)
+{
+  uint32_t *counts = calloc(STATS_BUCKETS, sizeof(uint32_t));
+
+  if (!mine) {
+    mine = calloc(1, sizeof(sthread_t));
+    pthread_setspecific(statskey, mine);
+    pthread_mutex_lock(&statslock);
+    mine->next = threads;
+    threads = mine;
+    pthread_mutex_unlock(&statslock);
+  }
+  __atomic_store_n(&mine->counts[metric], counts, __ATOMIC_RELEASE);
+  return counts;
+}
+
+
+void stats_record(int metric, uint64_t start)
+{
+  uint64_t ticks = stats_now() - start;
+  uint32_t *counts;
+  size_t bucket;
+
+  if (metric <= 0)
+    return;
+  if (!mine || !(counts = mine->counts[metric]))
+    counts = stats_counts(metric);
+  bucket = stats_bucket(ticks);
+  __atomic_store_n(counts+bucket, counts[bucket] + 1, __ATOMIC_RELAXED);
+  if (ticks > mine->max[metric])
+    __atomic_store_n(&mine->max[metric], ticks, __ATOMIC_RELAXED);
+}
+
+
+/* The `p`th percentile of `count` samples, in ticks: the top of the bucket
+ * it falls in */
+static uint64_t stats_percentile(const uint64_t *buckets, uint64_t count,
+                                 int p)
+{
+  uint64_t rank = (count * p + 99) / 100;
+  uint64_t seen = 0;
+  size_t i;
+
+  for (i = 0; i < STATS_BUCKETS - 1; i++)
+    if ((seen += buckets[i]) >= rank)
+      break;
+  return stats_bucket_top(i);
+}
+
+
+size_t stats_read(stats_t *stats)
+{
+  // only used under the lock
+  static uint64_t buckets[STATS_BUCKETS];
+  struct timespec now;
+  sthread_t *thread;
+  uint32_t *counts;
+  uint64_t max, ticks;
+  double per_ns = 1.0;
+  size_t n = 0;
+  size_t j;
+  int i;
+
+  pthread_once(&statsonce, stats_init);
+#if defined(__x86_64__) || defined(__i386__)
+  // the counter's rate, measured over the whole run so far
+  ticks = stats_now() - tick0;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (stats_ns(&now) > stats_ns(&time0))
+    per_ns = (double)ticks / (stats_ns(&now) - stats_ns(&time0));
+#endif
+  pthread_mutex_lock(&statslock);
+  for (i = 1; i < name_c; i++) {
+    memcpy(buckets, retired[i], sizeof(buckets));
+    max = retired_max[i];
+    for (thread = threads; thread; thread = thread->next) {
+      if (!(counts = __atomic_load_n(&thread->counts[i], __ATOMIC_ACQUIRE)))
+        continue;
+      for (j = 0; j < STATS_BUCKETS; j++)
+        buckets[j] += __atomic_load_n(counts+j, __ATOMIC_RELAXED);
+      ticks = __atomic_load_n(&thread->max[i], __ATOMIC_RELAXED);
+      if (ticks > max)
+        max = ticks;
+    }
+    stats[n].name = names[i];
+    for (stats[n].count = j = 0; j < STATS_BUCKETS; j++)
+      stats[n].count += buckets[j];
+    if (!stats[n].count)
+      continue;
+    // a bucket's top can be past the longest sample in it
+    stats[n].p50 = stats_percentile(buckets, stats[n].count, 50);
+    stats[n].p90 = stats_percentile(buckets, stats[n].count, 90);
+    stats[n].p99 = stats_percentile(buckets, stats[n].count, 99);
+    stats[n].p50 = (stats[n].p50 < max ? stats[n].p50 : max) / per_ns;
+    stats[n].p90 = (stats[n].p90 < max ? stats[n].p90 : max) / per_ns;
+    stats[n].p99 = (stats[n].p99 < max ? stats[n].p99 : max) / per_ns;
+    stats[n].max = max / per_ns;
+    n++;
+  }
+  pthread_mutex_unlock(&statslock);
+  return n;
+}
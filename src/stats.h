@@ -0,0 +1,57 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* How many operations can be timed */
+#ifndef STATS_MAX
+#define STATS_MAX 64
+#endif
+
+
+/* Latency histograms of named operations.  Each thread records into its
+ * own buckets, a few per power of two of the time taken, and the threads
+ * are only added together when the histograms are read. */
+
+/* The merged timings of an operation, in nanoseconds */
+typedef struct stats_s {
+  const char *name;
+  uint64_t count;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t max;
+} stats_t;
+
+
+/**
+ * @brief The id to record an operation's timings under, registering it if
+ * it is new
+ * @param name Kept as it is, so it must outlive the program's use of it
+ * @return The id, or 0 once STATS_MAX operations are registered (recording
+ *         under 0 does nothing)
+ */
+int stats_metric(const char *name);
+
+/**
+ * @brief The current time, in the units `stats_record` takes
+ * On x86 this is the time stamp counter, converted when read.
+ */
+uint64_t stats_now(void);
+
+/**
+ * @brief Records that an operation took from `start` (from `stats_now`)
+ * until now
+ */
+void stats_record(int metric, uint64_t start);
+
+/**
+ * @brief Reads the timings of the operations recorded so far, in the order
+ * they were registered; those never recorded are left out
+ * @param stats An array of at least STATS_MAX
+ * @return The number of operations filled in
+ */
+size_t stats_read(stats_t *stats);
+
+#endif
@@ -0,0 +1,74 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "strbuf.h"
+
+
+void strbuf_reset(strbuf_t *sb)
+{
+  sb->len = 0;
+  if (sb->str)
+    sb->str[0] = 0;
+}
+
+
+void strbuf_reserve(strbuf_t *sb, size_t len)
+{
+  // one more for the terminator
+  if (sb->len + len + 1 <= sb->cap)
+    return;
+  if (!sb->cap)
+    sb->cap = 256;
+  while (sb->cap < sb->len + len + 1)
+    sb->cap *= 2;
+  sb->str = realloc(sb->str, sb->cap);
+}
+
+
+void strbuf_ncat(strbuf_t *sb, const char *str, size_t len)
+{
+  strbuf_reserve(sb, len);
+  memcpy(sb->str+sb->len, str, len);
+  sb->len += len;
+  sb->str[sb->len] = 0;
+}
+
+
+void strbuf_cat(strbuf_t *sb, const char *str)
+{
+  strbuf_ncat(sb, str, strlen(str));
+}
+
+
+void strbuf_printf(strbuf_t *sb, const char *format, ...)
+{
+  va_list args;
+  int len;
+
+  strbuf_reserve(sb, 0);
+  va_start(args, format);
+  len = vsnprintf(sb->str+sb->len, sb->cap-sb->len, format, args);
+  va_end(args);
+  if (len < 0) {
+    sb->str[sb->len] = 0;
+    return;
+  }
+  // most lines fit what is left; the rest are formatted again once grown
+  if ((size_t)len >= sb->cap-sb->len) {
+    strbuf_reserve(sb, len);
+    va_start(args, format);
+    vsnprintf(sb->str+sb->len, sb->cap-sb->len, format, args);
+    va_end(args);
+  }
+  sb->len += len;
+}
+
+
+void strbuf_free(strbuf_t *sb)
+{
+  free(sb->str);
+  sb->str = NULL;
+  sb->len = sb->cap = 0;
+}
@@ -0,0 +1,47 @@
+#ifndef STRBUF_H
+#define STRBUF_H
+
+#include <stddef.h>
+
+
+/* A growable string that knows its length, so appending does not rescan
+ * what is already there.  A zeroed strbuf_t is an empty one. */
+typedef struct strbuf_s {
+  char *str;
+  size_t len;
+  size_t cap;
+} strbuf_t;
+
+
+/**
+ * @brief Empties a string, keeping its memory for reuse
+ */
+void strbuf_reset(strbuf_t *sb);
+
+/**
+ * @brief Makes room for at least `len` more characters
+ */
+void strbuf_reserve(strbuf_t *sb, size_t len);
+
+/**
+ * @brief Appends a string
+ */
+void strbuf_cat(strbuf_t *sb, const char *str);
+
+/**
+ * @brief Appends `len` characters of `str`
+ */
+void strbuf_ncat(strbuf_t *sb, const char *str, size_t len);
+
+/**
+ * @brief Appends formatted text, as `sprintf`
+ */
+void strbuf_printf(strbuf_t *sb, const char *format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Frees a string's memory, leaving it empty
+ */
+void strbuf_free(strbuf_t *sb);
+
+#endif
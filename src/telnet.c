@@ -1,6 +1,8 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +11,22 @@
 
 #include "telnet.h"
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+struct telnet_session_s {
+  int fd;
+  int refs;
+  int closed;
+  pthread_mutex_t lock;
+  char *pending;
+  size_t pending_c;
+  size_t pending_cap;
+};
+
+static __thread telnet_session_t *self = NULL;
+
 
 telnet_t telnet_init(unsigned short port)
 {
@@ -26,6 +44,7 @@ telnet_t telnet_init(unsigned short port)
   assert(0 == setsockopt(telnet.fd, SOL_SOCKET, SO_REUSEADDR, &truth, sizeof(int)));
   assert(0 == bind(telnet.fd, (struct sockaddr *)(&(telnet.ssocket)), sizeof(struct sockaddr_in)));
   telnet.listener = NULL;
+  telnet.more = NULL;
   return telnet;
 }
 
@@ -35,34 +54,134 @@ int telnet_listener(telnet_t *telnet, const char* (*listener)(const char *, void
   return 0;
 }
 
+int telnet_more(telnet_t *telnet, const char* (*more)(void **))
+{
+  telnet->more = more;
+  return 0;
+}
+
+/* Sends as much pending output as the socket takes without blocking;
+ * called with the session locked */
+static void _telnet_flush(telnet_session_t *session)
+{
+  ssize_t sent;
+
+  while (session->pending_c && !session->closed) {
+    sent = send(session->fd, session->pending, session->pending_c,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno != EINTR)
+        session->closed = 1;
+      continue;
+    }
+    session->pending_c -= sent;
+    memmove(session->pending, session->pending+sent, session->pending_c);
+  }
+}
+
+/* Queues output for a session; `wait` blocks until all of it is sent,
+ * otherwise a client over TELNET_BACKLOG is cut off */
+static int _telnet_send(telnet_session_t *session, const char *string,
+                        int wait)
+{
+  struct pollfd pfd;
+  size_t len = strlen(string);
+  ssize_t sent;
+  int status;
+
+  pthread_mutex_lock(&session->lock);
+  if (!wait && !session->closed &&
+      session->pending_c + len > TELNET_BACKLOG) {
+    session->closed = 1;
+    shutdown(session->fd, SHUT_RDWR);
+  }
+  // with nothing queued ahead of it, the string goes out without a copy
+  while (!session->closed && !session->pending_c && len) {
+    sent = send(session->fd, string, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      if (errno != EINTR)
+        session->closed = 1;
+      continue;
+    }
+    string += sent;
+    len -= sent;
+  }
+  if (!session->closed && len) {
+    if (session->pending_c + len > session->pending_cap) {
+      session->pending_cap = session->pending_c + len;
+      session->pending = realloc(session->pending, session->pending_cap);
+    }
+    memcpy(session->pending+session->pending_c, string, len);
+    session->pending_c += len;
+    _telnet_flush(session);
+  }
+  while (wait && session->pending_c && !session->closed) {
+    pthread_mutex_unlock(&session->lock);
+    pfd.fd = session->fd;
+    pfd.events = POLLOUT;
+    poll(&pfd, 1, -1);
+    pthread_mutex_lock(&session->lock);
+    _telnet_flush(session);
+  }
+  status = session->closed ? -1 : 0;
+  pthread_mutex_unlock(&session->lock);
+  return status;
+}
+
+/* Sends a reply and whatever continues it, one piece at a time */
+static void _telnet_reply(telnet_session_t *session, const char *string,
+                          const char* (*more)(void **), void **data)
+{
+  int status = _telnet_send(session, string, 1);
+  while (more && status == 0 && (string = more(data)))
+    status = _telnet_send(session, string, 1);
+}
+
 // BUG: cannot receive more than 512 bytes of data
 static void *_telnet_client(void *_)
 {
-  int fd = ((telnet_t*)_)->fd;
+  telnet_session_t *session;
   const char* (*listener)(const char*, void**) = ((telnet_t*)_)->listener;
+  const char* (*more)(void**) = ((telnet_t*)_)->more;
   char ibuffer[512];
   ssize_t rlen;
   const char *ostring;
   void *data = NULL;
+
+  session = calloc(1, sizeof(telnet_session_t));
+  session->fd = ((telnet_t*)_)->fd;
+  session->refs = 1;
+  pthread_mutex_init(&session->lock, NULL);
+  self = session;
   free(_);
   _ = NULL;
 
   if ((ostring = listener(NULL, &data)))
-    send(fd, ostring, strlen(ostring), 0);
+    _telnet_reply(session, ostring, more, &data);
   while(1) {
-    rlen = recv(fd, ibuffer, 511, 0);
-    if (rlen == 0 || ibuffer[0] < 0 || ibuffer[0] == 4)
+    rlen = recv(session->fd, ibuffer, 511, 0);
+    if (rlen <= 0 || ibuffer[0] < 0 || ibuffer[0] == 4)
       break;
-    for (rlen--; ibuffer[rlen] == '\n' || ibuffer[rlen] == '\r'; rlen--);
+    for (rlen--; rlen >= 0 && (ibuffer[rlen] == '\n' || ibuffer[rlen] == '\r');
+         rlen--);
     ibuffer[++rlen] = 0;
     ostring = listener(ibuffer, &data);
     if (!ostring)
       break;
-    send(fd, ostring, strlen(ostring), 0);
+    _telnet_reply(session, ostring, more, &data);
   }
   if ((ostring = listener(NULL, &data)))
-    send(fd, ostring, strlen(ostring), 0);
-  close(fd);
+    _telnet_send(session, ostring, 1);
+  pthread_mutex_lock(&session->lock);
+  session->closed = 1;
+  shutdown(session->fd, SHUT_RDWR);
+  pthread_mutex_unlock(&session->lock);
+  self = NULL;
+  telnet_release(session);
   return NULL;
 }
 
@@ -102,3 +221,39 @@ int telnet_stop(telnet_t *telnet)
   assert(0 == close(telnet->fd));
   return 0;
 }
+
+
+telnet_session_t *telnet_self(void)
+{
+  return self;
+}
+
+telnet_session_t *telnet_hold(telnet_session_t *session)
+{
+  pthread_mutex_lock(&session->lock);
+  session->refs++;
+  pthread_mutex_unlock(&session->lock);
+  return session;
+}
+
+void telnet_release(telnet_session_t *session)
+{
+  int refs;
+
+  pthread_mutex_lock(&session->lock);
+  refs = --session->refs;
+  pthread_mutex_unlock(&session->lock);
+  // the descriptor lives as long as the session so it is never reused
+  // under a holder's feet
+  if (refs == 0) {
+    close(session->fd);
+    pthread_mutex_destroy(&session->lock);
+    free(session->pending);
+    free(session);
+  }
+}
+
+int telnet_write(telnet_session_t *session, const char *string)
+{
+  return _telnet_send(session, string, 0);
+}
@@ -4,14 +4,23 @@
 #include <pthread.h>
 #include <arpa/inet.h>
 
+/* Bytes a session may leave unsent before pushes to it are given up */
+#ifndef TELNET_BACKLOG
+#define TELNET_BACKLOG 65536
+#endif
+
 
 typedef struct telnet_s {
   int fd;
   struct sockaddr_in ssocket;
   const char* (*listener)(const char*, void **);
+  const char* (*more)(void **);
   pthread_t thread;
 } telnet_t;
 
+/* A connected client, which can be written to from any thread */
+typedef struct telnet_session_s telnet_session_t;
+
 
 /**
  * @brief Creates a new telnet identifier listening on the specified port
@@ -37,6 +46,17 @@ telnet_t telnet_init(unsigned short port);
  */
 int telnet_listener(telnet_t *, const char* (*listener)(const char*, void**));
 
+/**
+ * @brief Sets the function that continues a reply, for replies too large to
+ * be built in one piece
+ * Once each string the listener returns has been sent, the function is
+ * called with the same state, and each string it returns is sent in turn as
+ * the client takes it, until it returns NULL.  The string need only stay
+ * valid until the next call.
+ * This function should be called before `telnet_start`.
+ */
+int telnet_more(telnet_t *, const char* (*more)(void**));
+
 /**
  * @brief Begins listening for incoming connections.
  */
@@ -48,4 +68,27 @@ pthread_t *telnet_start(telnet_t *);
  */
 int telnet_stop(telnet_t *);
 
+/**
+ * @brief The session whose input the calling listener is handling
+ * @return NULL outside of a listener call
+ */
+telnet_session_t *telnet_self(void);
+
+/**
+ * @brief Keeps a session allocated after its client disconnects
+ * Every hold must be matched by a `telnet_release`.
+ */
+telnet_session_t *telnet_hold(telnet_session_t *);
+
+void telnet_release(telnet_session_t *);
+
+/**
+ * @brief Sends a string to a session's client without waiting on it
+ * Whatever the socket does not take right away is kept in order and sent
+ * ahead of the next output; a client that leaves more than TELNET_BACKLOG
+ * bytes unread is disconnected.
+ * @return 0 on success, non-zero if the client is gone
+ */
+int telnet_write(telnet_session_t *, const char *);
+
 #endif
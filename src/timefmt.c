@@ -0,0 +1,273 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timefmt.h"
+
+/* The span of UTC times the local zone's offsets are tabulated for; times
+ * outside it are converted by libc */
+#ifndef TIMEFMT_ZONE_FIRST
+#define TIMEFMT_ZONE_FIRST 0
+#endif
+#ifndef TIMEFMT_ZONE_LAST
+#define TIMEFMT_ZONE_LAST 4102444800
+#endif
+
+
+/* The last day a thread formatted a time in, if the clock was not changed
+ * during it: its local midnight and what `ctime` puts either side of the
+ * time of day.  Checking a day costs two more `localtime_r`, so a day is
+ * only kept once a second time falls in it (`seen`), and only checked once
+ * (`changed` if the clock changes in it). */
+typedef struct tfday_s {
+  int valid;
+  time_t start;
+  time_t seen;
+  int changed;
+  char date[12];
+  char year[16];
+  size_t year_len;
+} tfday_t;
+
+static __thread tfday_t today;
+
+/* The local zone's UTC offset (in seconds) from `at` until the next entry */
+typedef struct tfzone_s {
+  time_t at;
+  long offset;
+} tfzone_t;
+
+static tfzone_t *zone = NULL;
+static size_t zone_c = 0;
+static pthread_once_t zoneonce = PTHREAD_ONCE_INIT;
+
+
+/* "Www Mmm dd " */
+static size_t timefmt_date(const struct tm *tm, char *out)
+{
+  static const char days[] = "SunMonTueWedThuFriSat";
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+  memcpy(out, days + 3 * tm->tm_wday, 3);
+  out[3] = ' ';
+  memcpy(out+4, months + 3 * tm->tm_mon, 3);
+  out[7] = ' ';
+  out[8] = tm->tm_mday < 10 ? ' ' : '0' + tm->tm_mday / 10;
+  out[9] = '0' + tm->tm_mday % 10;
+  out[10] = ' ';
+  return 11;
+}
+
+/* "hh:mm:ss" from seconds into the day */
+static size_t timefmt_clock(int secs, char *out)
+{
+  int h = secs / 3600, m = secs / 60 % 60, s = secs % 60;
+
+  out[0] = '0' + h / 10;
+  out[1] = '0' + h % 10;
+  out[2] = ':';
+  out[3] = '0' + m / 10;
+  out[4] = '0' + m % 10;
+  out[5] = ':';
+  out[6] = '0' + s / 10;
+  out[7] = '0' + s % 10;
+  return 8;
+}
+
+/* Remembers the day of `tm` (the local time `t`), unless its clock changes */
+static void timefmt_day(time_t t, const struct tm *tm)
+{
+  struct tm first, last;
+  time_t start = t - (tm->tm_hour * 3600 + tm->tm_min * 60 + tm->tm_sec);
+
+  today.valid = 0;
+  if (start != today.seen) {
+    today.seen = start;
+    today.changed = 0;
+    return;
+  }
+  if (today.changed)
+    return;
+  today.changed = 1;
+  if (!localtime_r(&start, &first) || first.tm_mday != tm->tm_mday ||
+      first.tm_hour || first.tm_min || first.tm_sec)
+    return;
+  start += 24 * 3600 - 1;
+  if (!localtime_r(&start, &last) || last.tm_mday != tm->tm_mday ||
+      last.tm_hour != 23 || last.tm_min != 59 || last.tm_sec != 59)
+    return;
+  today.changed = 0;
+  today.start = start - (24 * 3600 - 1);
+  timefmt_date(tm, today.date);
+  today.year_len = snprintf(today.year, sizeof(today.year), " %d",
+                            tm->tm_year + 1900);
+  today.valid = 1;
+}
+
+
+size_t timefmt_ctime(time_t t, char *out)
+{
+  struct tm tm;
+  size_t len;
+
+  if (!today.valid || t < today.start || t - today.start >= 24 * 3600) {
+    if (!localtime_r(&t, &tm)) {
+      *out = 0;
+      return 0;
+    }
+    timefmt_day(t, &tm);
+    if (!today.valid) {
+      // formatted from scratch: a day not seen before, or with a clock change
+      len = timefmt_date(&tm, out);
+      len += timefmt_clock(tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec,
+                           out+len);
+      return len + sprintf(out+len, " %d", tm.tm_year + 1900);
+    }
+  }
+  memcpy(out, today.date, 11);
+  len = 11 + timefmt_clock(t - today.start, out+11);
+  memcpy(out+len, today.year, today.year_len + 1);
+  return len + today.year_len;
+}
+
+
+/* Days from 1970-01-01 to a date of the proleptic Gregorian calendar */
+static long timefmt_days(long y, int m, int d)
+{
+  long era;
+  int yoe, doy;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/* The UTC offset at `t` according to libc, 0 if it cannot tell */
+static long timefmt_probe(time_t t)
+{
+  struct tm tm;
+
+  if (!localtime_r(&t, &tm))
+    return 0;
+  return timefmt_days(tm.tm_year + 1900L, tm.tm_mon + 1, tm.tm_mday) * 86400 +
+    tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec - t;
+}
+
+static void timefmt_zone_add(time_t at, long offset)
+{
+  if ((zone_c & (zone_c - 1)) == 0)
+    zone = realloc(zone, (zone_c ? zone_c * 2 : 64) * sizeof(tfzone_t));
+  zone[zone_c].at = at;
+  zone[zone_c++].offset = offset;
+}
+
+/* Steps through the span a day at a time and pins each change of offset
+ * down to the second */
+static void timefmt_zone(void)
+{
+  time_t t = TIMEFMT_ZONE_FIRST, lo, hi, mid;
+  long offset = timefmt_probe(t);
+
+  timefmt_zone_add(t, offset);
+  while (t < TIMEFMT_ZONE_LAST) {
+    hi = (t + 24 * 3600 < TIMEFMT_ZONE_LAST) ? t + 24 * 3600 : TIMEFMT_ZONE_LAST;
+    if (timefmt_probe(hi) == offset) {
+      t = hi;
+      continue;
+    }
+    for (lo = t; hi - lo > 1; ) {
+      mid = lo + (hi - lo) / 2;
+      if (timefmt_probe(mid) == offset)
+        lo = mid;
+      else
+        hi = mid;
+    }
+    t = hi;
+    offset = timefmt_probe(t);
+    timefmt_zone_add(t, offset);
+  }
+}
+
+/* The last entry of the zone at or before `t` */
+static size_t timefmt_zone_find(time_t t)
+{
+  size_t lo = 0, hi = zone_c, mid;
+
+  while (hi - lo > 1) {
+    mid = (lo + hi) / 2;
+    if (zone[mid].at <= t)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* The value of `n` digits, or -1 if any is not one */
+static long timefmt_digits(const char *str, int n)
+{
+  long value = 0;
+
+  for (; n > 0; n--, str++) {
+    if (*str < '0' || *str > '9')
+      return -1;
+    value = value * 10 + (*str - '0');
+  }
+  return value;
+}
+
+
+int timefmt_parse(const char *date, const char *clock, time_t *t)
+{
+  static const int mdays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  struct tm tm;
+  long y, m, d, h, min;
+  time_t local, end, at;
+  size_t i;
+
+  if (!date || !clock || strlen(date) != 10 || strlen(clock) != 5 ||
+      date[4] != '-' || date[7] != '-' || clock[2] != ':')
+    return -1;
+  y = timefmt_digits(date, 4);
+  m = timefmt_digits(date+5, 2);
+  d = timefmt_digits(date+8, 2);
+  h = timefmt_digits(clock, 2);
+  min = timefmt_digits(clock+3, 2);
+  if (y < 0 || m < 1 || m > 12 || d < 1 || d > mdays[m-1] || h < 0 ||
+      h > 23 || min < 0 || min > 59)
+    return -1;
+  if (m == 2 && d == 29 && (y % 4 != 0 || (y % 100 == 0 && y % 400 != 0)))
+    return -1;
+  pthread_once(&zoneonce, timefmt_zone);
+  // the local time as if it were UTC; no offset is more than a day
+  local = timefmt_days(y, m, d) * 86400 + h * 3600 + min * 60;
+  if (local - 2 * 86400 < TIMEFMT_ZONE_FIRST ||
+      local + 2 * 86400 >= TIMEFMT_ZONE_LAST) {
+    memset(&tm, 0, sizeof(struct tm));
+    tm.tm_year = y - 1900;
+    tm.tm_mon = m - 1;
+    tm.tm_mday = d;
+    tm.tm_hour = h;
+    tm.tm_min = min;
+    tm.tm_isdst = -1;
+    *t = mktime(&tm);
+    return 0;
+  }
+  // the earliest stretch of a single offset that has the time in it; in a
+  // gap, the last stretch it would have been in had the clocks not moved
+  *t = local - zone[timefmt_zone_find(local)].offset;
+  for (i = timefmt_zone_find(local - 2 * 86400);
+       i < zone_c && zone[i].at <= local + 2 * 86400; i++) {
+    at = local - zone[i].offset;
+    end = (i+1 < zone_c) ? zone[i+1].at : TIMEFMT_ZONE_LAST;
+    if (at < zone[i].at)
+      continue;
+    *t = at;
+    if (at < end)
+      break;
+  }
+  return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef TIMEFMT_H
+#define TIMEFMT_H
+
+#include <stddef.h>
+#include <time.h>
+
+/* Enough for any time `timefmt_ctime` formats, with its terminator */
+#define TIMEFMT_SIZE 32
+
+
+/**
+ * @brief Formats a time in local time as `ctime` does, without the newline
+ * Each thread keeps the date of the last day it formatted, so most times
+ * do not go through the time zone rules.
+ * @param out At least TIMEFMT_SIZE characters
+ * @return The length of the formatted time
+ */
+size_t timefmt_ctime(time_t t, char *out);
+
+/**
+ * @brief Reads a local date and time of day, "YYYY-MM-DD" and "hh:mm"
+ * The local zone's changes of UTC offset are tabulated on the first call.
+ * A time skipped when the clocks go forward is read as if they had not; one
+ * repeated when they go back is the first of the two.
+ * @return 0 on success, non-zero if either is malformed or not a real date
+ *         or time
+ */
+int timefmt_parse(const char *date, const char *clock, time_t *t);
+
+#endif
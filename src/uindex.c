@@ -0,0 +1,378 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "minutes.h"
+#include "uindex.h"
+
+
+/* Users hash into an open-addressed table; each keeps its reservations
+ * packed to minutes (with the room in `other`) in an array sorted by
+ * (start, id), and any whose times do not pack whole in a second one. */
+typedef struct uslot_s {
+  int user;
+  int used;
+  cres_t *recs;
+  size_t count;
+  size_t cap;
+  reservation_t *wide;
+  size_t wide_c;
+} uslot_t;
+
+/* Reservation ids map to their users, and packed starts to find them by,
+ * in a second table */
+typedef struct urid_s {
+  int32_t id;
+  int32_t user;
+  minute_t start;
+} urid_t;
+
+static uslot_t *slots = NULL;
+static size_t slot_c = 0;
+static size_t used_c = 0;
+static urid_t *ids = NULL;
+static size_t id_c = 0;
+static size_t id_used = 0;
+static pthread_rwlock_t uindexlock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static size_t uindex_hash(int user)
+{
+  return ((uint32_t)user * 2654435761u);
+}
+
+/* The slot of `user`, or the free slot it would take */
+static uslot_t *uindex_slot(int user)
+{
+  size_t i;
+
+  if (slot_c == 0)
+    return NULL;
+  for (i = uindex_hash(user) & (slot_c-1); slots[i].used; i = (i+1) & (slot_c-1))
+    if (slots[i].user == user)
+      return slots+i;
+  return slots+i;
+}
+
+static void uindex_grow(void)
+{
+  uslot_t *old = slots;
+  size_t old_c = slot_c;
+  uslot_t *slot;
+  size_t i;
+
+  slot_c = slot_c ? slot_c * 2 : 1024;
+  slots = calloc(slot_c, sizeof(uslot_t));
+  for (i = 0; i < old_c; i++) {
+    if (!old[i].used)
+      continue;
+    slot = uindex_slot(old[i].user);
+    *slot = old[i];
+  }
+  free(old);
+}
+
+/* The slot of reservation `id` in `ids`, or the free slot it would take */
+static urid_t *uindex_id_slot(int id)
+{
+  size_t i;
+
+  if (id_c == 0)
+    return NULL;
+  for (i = uindex_hash(id) & (id_c-1); ids[i].id; i = (i+1) & (id_c-1))
+    if (ids[i].id == id)
+      return ids+i;
+  return ids+i;
+}
+
+static void uindex_id_add(int id, int user, minute_t start)
+{
+  urid_t *old = ids;
+  size_t old_c = id_c;
+  size_t i;
+
+  if (2 * (id_used + 1) > id_c) {
+    id_c = id_c ? id_c * 2 : 1024;
+    ids = calloc(id_c, sizeof(urid_t));
+    for (i = 0; i < old_c; i++)
+      if (old[i].id)
+        *uindex_id_slot(old[i].id) = old[i];
+    free(old);
+  }
+  ids[uindex_id_slot(id) - ids] = (urid_t){ id, user, start };
+  id_used++;
+}
+
+/* Linear probing lets a deletion pull later entries of its run back
+ * instead of leaving a marker */
+static void uindex_id_remove(int id)
+{
+  urid_t *slot = uindex_id_slot(id);
+  size_t i, j, home;
+
+  if (!slot || !slot->id)
+    return;
+  i = slot - ids;
+  ids[i].id = 0;
+  id_used--;
+  for (j = (i+1) & (id_c-1); ids[j].id; j = (j+1) & (id_c-1)) {
+    home = uindex_hash(ids[j].id) & (id_c-1);
+    // move it back unless its home lies cyclically in (i, j]
+    if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+      ids[i] = ids[j];
+      ids[j].id = 0;
+      i = j;
+    }
+  }
+}
+
+/* The position of `rec` in a user's packed records, or where it would go */
+static size_t uindex_lower(const uslot_t *slot, const cres_t *rec)
+{
+  size_t lo = 0, hi = slot->count, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (slot->recs[mid].start < rec->start ||
+        (slot->recs[mid].start == rec->start && slot->recs[mid].id < rec->id))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Reservations that do not pack are rare enough to be kept unsorted */
+static void uindex_add_wide(uslot_t *slot, const reservation_t *reservation)
+{
+  slot->wide = realloc(slot->wide, (slot->wide_c+1) * sizeof(reservation_t));
+  slot->wide[slot->wide_c] = *reservation;
+  slot->wide[slot->wide_c++].next = NULL;
+}
+
+static int uindex_remove_wide(uslot_t *slot, int id)
+{
+  size_t i;
+
+  for (i = 0; i < slot->wide_c; i++)
+    if (slot->wide[i].id == id) {
+      slot->wide[i] = slot->wide[--slot->wide_c];
+      return 0;
+    }
+  return -1;
+}
+
+static int compar_start(const void *a, const void *b)
+{
+  const reservation_t *x = a, *y = b;
+  if (x->start != y->start)
+    return x->start < y->start ? -1 : 1;
+  return (x->id > y->id) - (x->id < y->id);
+}
+
+
+void uindex_add(const reservation_t *reservation)
+{
+  uslot_t *slot;
+  cres_t rec;
+  size_t at;
+
+  pthread_rwlock_wrlock(&uindexlock);
+  // kept at most half full
+  if (2 * (used_c + 1) > slot_c)
+    uindex_grow();
+  slot = uindex_slot(reservation->user_id);
+  if (!slot->used) {
+    slot->used = 1;
+    slot->user = reservation->user_id;
+    used_c++;
+  }
+  if (0 != cres_pack(&rec, reservation->id, reservation->room_id,
+                     reservation->start, reservation->end)) {
+    uindex_id_add(reservation->id, reservation->user_id, 0);
+    uindex_add_wide(slot, reservation);
+    pthread_rwlock_unlock(&uindexlock);
+    return;
+  }
+  if (slot->count == slot->cap) {
+    slot->cap = slot->cap ? slot->cap * 2 : 4;
+    slot->recs = realloc(slot->recs, slot->cap * sizeof(cres_t));
+  }
+  uindex_id_add(reservation->id, reservation->user_id, rec.start);
+  at = uindex_lower(slot, &rec);
+  memmove(slot->recs+at+1, slot->recs+at, (slot->count-at) * sizeof(cres_t));
+  slot->recs[at] = rec;
+  slot->count++;
+  pthread_rwlock_unlock(&uindexlock);
+}
+
+
+void uindex_remove(const reservation_t *reservation)
+{
+  uslot_t *slot;
+  cres_t rec;
+  size_t at;
+
+  pthread_rwlock_wrlock(&uindexlock);
+  slot = uindex_slot(reservation->user_id);
+  if (!slot || !slot->used) {
+    at = 0;
+  } else if (0 == cres_pack(&rec, reservation->id, reservation->room_id,
+                            reservation->start, reservation->end)) {
+    at = uindex_lower(slot, &rec);
+  } else {
+    at = slot->count;
+  }
+  if (slot && slot->used && at < slot->count &&
+      slot->recs[at].id == reservation->id) {
+    slot->count--;
+    memmove(slot->recs+at, slot->recs+at+1,
+            (slot->count-at) * sizeof(cres_t));
+    uindex_id_remove(reservation->id);
+  } else if (slot && slot->used &&
+             0 == uindex_remove_wide(slot, reservation->id)) {
+    uindex_id_remove(reservation->id);
+  }
+  pthread_rwlock_unlock(&uindexlock);
+}
+
+
+void uindex_archive(time_t before)
+{
+  time_t start, end;
+  size_t i, j, k;
+
+  pthread_rwlock_wrlock(&uindexlock);
+  for (i = 0; i < slot_c; i++) {
+    for (j = k = 0; j < slots[i].count; j++) {
+      cres_unpack(slots[i].recs+j, &start, &end);
+      if (end >= before)
+        slots[i].recs[k++] = slots[i].recs[j];
+      else
+        uindex_id_remove(slots[i].recs[j].id);
+    }
+    slots[i].count = k;
+    for (j = k = 0; j < slots[i].wide_c; j++)
+      if (slots[i].wide[j].end >= before)
+        slots[i].wide[k++] = slots[i].wide[j];
+      else
+        uindex_id_remove(slots[i].wide[j].id);
+    slots[i].wide_c = k;
+  }
+  pthread_rwlock_unlock(&uindexlock);
+}
+
+
+ssize_t uindex_user(int user, reservation_t *reservations)
+{
+  uslot_t *slot;
+  size_t count, wide;
+  size_t i;
+
+  pthread_rwlock_rdlock(&uindexlock);
+  slot = uindex_slot(user);
+  count = (slot && slot->used) ? slot->count : 0;
+  for (i = 0; reservations && i < count; i++) {
+    reservations[i].next = NULL;
+    reservations[i].id = slot->recs[i].id;
+    reservations[i].room_id = slot->recs[i].other;
+    reservations[i].user_id = user;
+    cres_unpack(slot->recs+i, &reservations[i].start, &reservations[i].end);
+  }
+  wide = (slot && slot->used) ? slot->wide_c : 0;
+  if (reservations && wide)
+    memcpy(reservations+count, slot->wide, wide * sizeof(reservation_t));
+  pthread_rwlock_unlock(&uindexlock);
+  if (reservations && wide)
+    qsort(reservations, count + wide, sizeof(reservation_t), compar_start);
+  return count + wide;
+}
+
+
+ssize_t uindex_user_page(int user, const reservation_t *after,
+                         reservation_t *reservations, size_t max)
+{
+  uslot_t *slot;
+  reservation_t *r;
+  time_t start, end;
+  size_t lo, hi, mid;
+  size_t count = 0;
+  size_t i;
+
+  pthread_rwlock_rdlock(&uindexlock);
+  slot = uindex_slot(user);
+  if (!slot || !slot->used) {
+    pthread_rwlock_unlock(&uindexlock);
+    return 0;
+  }
+  // `after` need not pack, so the records are compared unpacked
+  for (lo = 0, hi = after ? slot->count : 0; lo < hi; ) {
+    mid = (lo + hi) / 2;
+    cres_unpack(slot->recs+mid, &start, &end);
+    if (start < after->start ||
+        (start == after->start && slot->recs[mid].id <= after->id))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (i = lo; i < slot->count && count < max; i++, count++) {
+    reservations[count].next = NULL;
+    reservations[count].id = slot->recs[i].id;
+    reservations[count].room_id = slot->recs[i].other;
+    reservations[count].user_id = user;
+    cres_unpack(slot->recs+i, &reservations[count].start,
+                &reservations[count].end);
+  }
+  // the few wide ones are merged in, each displacing the page's last if
+  // it is full
+  for (i = 0; i < slot->wide_c && max; i++) {
+    r = slot->wide+i;
+    if (after && compar_start(r, after) <= 0)
+      continue;
+    if (count == max && compar_start(r, reservations+count-1) >= 0)
+      continue;
+    if (count == max)
+      count--;
+    for (lo = count; lo > 0 && compar_start(r, reservations+lo-1) < 0; lo--)
+      reservations[lo] = reservations[lo-1];
+    reservations[lo] = *r;
+    count++;
+  }
+  pthread_rwlock_unlock(&uindexlock);
+  return count;
+}
+
+
+int uindex_find(int id, reservation_t *reservation)
+{
+  urid_t *found;
+  uslot_t *slot;
+  cres_t key;
+  size_t i;
+  int status = 1;
+
+  pthread_rwlock_rdlock(&uindexlock);
+  found = uindex_id_slot(id);
+  slot = (found && found->id) ? uindex_slot(found->user) : NULL;
+  if (slot) {
+    key.id = id;
+    key.start = found->start;
+    i = uindex_lower(slot, &key);
+    if (i < slot->count && slot->recs[i].id == id) {
+      reservation->next = NULL;
+      reservation->id = id;
+      reservation->room_id = slot->recs[i].other;
+      reservation->user_id = slot->user;
+      cres_unpack(slot->recs+i, &reservation->start, &reservation->end);
+      status = 0;
+    }
+  }
+  for (i = 0; slot && status && i < slot->wide_c; i++)
+    if (slot->wide[i].id == id) {
+      *reservation = slot->wide[i];
+      status = 0;
+    }
+  pthread_rwlock_unlock(&uindexlock);
+  return status;
+}
@@ -0,0 +1,48 @@
+#ifndef UINDEX_H
+#define UINDEX_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+
+/* The per-user index of current reservations kept by the scheduler, so a
+ * user's reservations are found without going through every room.
+ * Reservations are identified by their `id`. */
+
+/**
+ * @brief Adds a stored reservation to its user's index
+ */
+void uindex_add(const reservation_t *reservation);
+
+/**
+ * @brief Removes a reservation from its user's index, if it is there
+ * Changes are applied in the order the backend made them, so a reservation
+ * that is not there was made by another process and was never indexed.
+ */
+void uindex_remove(const reservation_t *reservation);
+
+/**
+ * @brief Drops every reservation that ended before `before`, as archiving
+ */
+void uindex_archive(time_t before);
+
+/**
+ * @brief Looks up a current reservation by its id
+ * @return 0 if found, non-zero if there is no such reservation
+ */
+int uindex_find(int id, reservation_t *reservation);
+
+/**
+ * @brief As `sched_reservations_user`, ordered by start time
+ */
+ssize_t uindex_user(int user, reservation_t *reservations);
+
+/**
+ * @brief As `sched_page_user`, ordered by start time and then id
+ */
+ssize_t uindex_user_page(int user, const reservation_t *after,
+                         reservation_t *reservations, size_t max);
+
+#endif
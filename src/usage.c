@@ -0,0 +1,213 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "usage.h"
+
+
+/* Every total is a counter in one open-addressed table, keyed by what it
+ * counts, whose room or user, and which bucket (day, week or hour). */
+#define USAGE_ROOM_DAY 1
+#define USAGE_ROOM_WEEK 2
+#define USAGE_ROOM_HOUR 3
+#define USAGE_USER_TIME 4
+#define USAGE_USER_COUNT 5
+
+typedef struct ucount_s {
+  int kind;
+  int id;
+  int bucket;
+  time_t value;
+} ucount_t;
+
+/* The part of a reservation within one local hour */
+typedef struct uspan_s {
+  int day;
+  int hour;
+  time_t len;
+} uspan_t;
+
+/* Spans a reservation is split into without going to the heap */
+#ifndef USAGE_SPANS
+#define USAGE_SPANS 32
+#endif
+
+static ucount_t *counts = NULL;
+static size_t count_c = 0;
+static size_t used_c = 0;
+static pthread_rwlock_t usagelock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static size_t usage_hash(int kind, int id, int bucket)
+{
+  uint64_t h = ((uint64_t)(uint32_t)id << 32) | (uint32_t)bucket;
+  h ^= (uint64_t)kind << 59;
+  h *= 0x9e3779b97f4a7c15ull;
+  return h ^ (h >> 29);
+}
+
+/* The counter of (kind, id, bucket), or the free slot it would take */
+static ucount_t *usage_slot(int kind, int id, int bucket)
+{
+  size_t i;
+
+  if (count_c == 0)
+    return NULL;
+  for (i = usage_hash(kind, id, bucket) & (count_c-1); counts[i].kind;
+       i = (i+1) & (count_c-1))
+    if (counts[i].kind == kind && counts[i].id == id &&
+        counts[i].bucket == bucket)
+      return counts+i;
+  return counts+i;
+}
+
+static time_t usage_get(int kind, int id, int bucket)
+{
+  ucount_t *slot = usage_slot(kind, id, bucket);
+  return (slot && slot->kind) ? slot->value : 0;
+}
+
+/* Linear probing lets a counter that drops to zero pull later entries of
+ * its run back instead of leaving a marker */
+static void usage_drop(ucount_t *slot)
+{
+  size_t i = slot - counts, j, home;
+
+  counts[i].kind = 0;
+  used_c--;
+  for (j = (i+1) & (count_c-1); counts[j].kind; j = (j+1) & (count_c-1)) {
+    home = usage_hash(counts[j].kind, counts[j].id, counts[j].bucket) &
+      (count_c-1);
+    // move it back unless its home lies cyclically in (i, j]
+    if ((i < j) ? (home <= i || home > j) : (home <= i && home > j)) {
+      counts[i] = counts[j];
+      counts[j].kind = 0;
+      i = j;
+    }
+  }
+}
+
+static void usage_bump(int kind, int id, int bucket, time_t value)
+{
+  ucount_t *old = counts;
+  ucount_t *slot;
+  size_t old_c = count_c;
+  size_t i;
+
+  // kept at most half full
+  if (2 * (used_c + 1) > count_c) {
+    count_c = count_c ? count_c * 2 : 4096;
+    counts = calloc(count_c, sizeof(ucount_t));
+    for (i = 0; i < old_c; i++)
+      if (old[i].kind)
+        *usage_slot(old[i].kind, old[i].id, old[i].bucket) = old[i];
+    free(old);
+  }
+  slot = usage_slot(kind, id, bucket);
+  if (!slot->kind) {
+    slot->kind = kind;
+    slot->id = id;
+    slot->bucket = bucket;
+    slot->value = 0;
+    used_c++;
+  }
+  slot->value += value;
+  if (slot->value == 0)
+    usage_drop(slot);
+}
+
+/* Days from 1970-01-01 to a local calendar date */
+static int usage_day(const struct tm *tm)
+{
+  int y = tm->tm_year + 1900 - (tm->tm_mon < 2);
+  int era = (y >= 0 ? y : y - 399) / 400;
+  int yoe = y - era * 400;
+  int doy = (153 * (tm->tm_mon + (tm->tm_mon < 2 ? 10 : -2)) + 2) / 5 +
+    tm->tm_mday - 1;
+  int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+/* Days since the Monday starting the week of `day` */
+static int usage_weekday(int day)
+{
+  return ((day + 3) % 7 + 7) % 7;
+}
+
+
+void usage_add(const reservation_t *reservation, int sign)
+{
+  uspan_t local[USAGE_SPANS];
+  uspan_t *spans = local;
+  size_t span_c = 0, span_cap = USAGE_SPANS;
+  struct tm tm;
+  time_t t, next;
+  size_t i;
+  int wday;
+
+  // split at every local hour, which also splits it at days and weeks;
+  // the time zone is worked out before the counters are locked
+  for (t = reservation->start; t < reservation->end; t = next) {
+    localtime_r(&t, &tm);
+    next = t + 3600 - tm.tm_min * 60 - tm.tm_sec;
+    if (next > reservation->end)
+      next = reservation->end;
+    if (span_c == span_cap) {
+      span_cap *= 2;
+      if (spans == local) {
+        spans = malloc(span_cap * sizeof(uspan_t));
+        memcpy(spans, local, span_c * sizeof(uspan_t));
+      } else {
+        spans = realloc(spans, span_cap * sizeof(uspan_t));
+      }
+    }
+    spans[span_c].day = usage_day(&tm);
+    spans[span_c].hour = tm.tm_hour;
+    spans[span_c++].len = sign * (next - t);
+  }
+
+  pthread_rwlock_wrlock(&usagelock);
+  for (i = 0; i < span_c; i++) {
+    wday = usage_weekday(spans[i].day);
+    usage_bump(USAGE_ROOM_DAY, reservation->room_id, spans[i].day,
+               spans[i].len);
+    usage_bump(USAGE_ROOM_WEEK, reservation->room_id, spans[i].day - wday,
+               spans[i].len);
+    usage_bump(USAGE_ROOM_HOUR, reservation->room_id,
+               wday * 24 + spans[i].hour, spans[i].len);
+  }
+  if (reservation->end > reservation->start)
+    usage_bump(USAGE_USER_TIME, reservation->user_id, 0,
+               sign * (reservation->end - reservation->start));
+  usage_bump(USAGE_USER_COUNT, reservation->user_id, 0, sign);
+  pthread_rwlock_unlock(&usagelock);
+  if (spans != local)
+    free(spans);
+}
+
+
+void usage_room(int room, time_t day, usage_t *usage)
+{
+  struct tm tm;
+  int d;
+  int i;
+
+  localtime_r(&day, &tm);
+  d = usage_day(&tm);
+  pthread_rwlock_rdlock(&usagelock);
+  usage->day = usage_get(USAGE_ROOM_DAY, room, d);
+  usage->week = usage_get(USAGE_ROOM_WEEK, room, d - usage_weekday(d));
+  for (i = 0; i < 7 * 24; i++)
+    usage->hours[i] = usage_get(USAGE_ROOM_HOUR, room, i);
+  pthread_rwlock_unlock(&usagelock);
+}
+
+
+void usage_user(int user, time_t *booked, time_t *count)
+{
+  pthread_rwlock_rdlock(&usagelock);
+  *booked = usage_get(USAGE_USER_TIME, user, 0);
+  *count = usage_get(USAGE_USER_COUNT, user, 0);
+  pthread_rwlock_unlock(&usagelock);
+}
@@ -0,0 +1,25 @@
+#ifndef USAGE_H
+#define USAGE_H
+
+#include "scheduler.h"
+
+
+/* Running totals of booked time, kept up to date by the scheduler so they
+ * are read without going through the reservations. */
+
+/**
+ * @brief Counts a reservation into the totals (`sign` 1), or out (-1)
+ */
+void usage_add(const reservation_t *reservation, int sign);
+
+/**
+ * @brief As `sched_usage_room`
+ */
+void usage_room(int room, time_t day, usage_t *usage);
+
+/**
+ * @brief As `sched_usage_user`
+ */
+void usage_user(int user, time_t *booked, time_t *count);
+
+#endif
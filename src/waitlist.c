@@ -0,0 +1,253 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "waitlist.h"
+
+
+/* Each room keeps its waiting entries sorted by start time.  Only entries
+ * starting after `start - longest` can reach into a freed interval, so a
+ * match is a binary search plus a short scan. */
+typedef struct wroom_s {
+  int id;
+  wentry_t *entries;
+  size_t count;
+  size_t cap;
+  time_t longest;
+} wroom_t;
+
+static wroom_t *wrooms = NULL;
+static size_t wroom_c = 0;
+static size_t wroom_cap = 0;
+static uint64_t wseq = 0;
+static pthread_mutex_t waitlock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static int compar_seq(const void *a, const void *b)
+{
+  const wentry_t *x = a, *y = b;
+  return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* The position of room `id` in `wrooms`, or where it would go */
+static size_t waitlist_room(int id)
+{
+  size_t lo = 0, hi = wroom_c, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (wrooms[mid].id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+static wroom_t *waitlist_find(int id)
+{
+  size_t at = waitlist_room(id);
+  return (at < wroom_c && wrooms[at].id == id) ? wrooms+at : NULL;
+}
+
+/* The first entry of a room starting at or after `start` */
+static size_t waitlist_lower(const wroom_t *room, time_t start)
+{
+  size_t lo = 0, hi = room->count, mid;
+
+  while (lo < hi) {
+    mid = (lo + hi) / 2;
+    if (room->entries[mid].reservation.start < start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Drops a room's entries whose window is over; only those starting before
+ * `now` can be */
+static void waitlist_expire(wroom_t *room, time_t now)
+{
+  size_t end = waitlist_lower(room, now);
+  size_t i, j;
+
+  for (i = j = 0; i < end; i++)
+    if (room->entries[i].reservation.end > now)
+      room->entries[j++] = room->entries[i];
+  if (j < end) {
+    memmove(room->entries+j, room->entries+end,
+            (room->count-end) * sizeof(wentry_t));
+    room->count -= end - j;
+  }
+}
+
+
+uint64_t waitlist_add(const reservation_t *reservation)
+{
+  wroom_t *room;
+  size_t at;
+  uint64_t seq;
+
+  pthread_mutex_lock(&waitlock);
+  at = waitlist_room(reservation->room_id);
+  if (at == wroom_c || wrooms[at].id != reservation->room_id) {
+    if (wroom_c == wroom_cap) {
+      wroom_cap = wroom_cap ? wroom_cap * 2 : 16;
+      wrooms = realloc(wrooms, wroom_cap * sizeof(wroom_t));
+    }
+    memmove(wrooms+at+1, wrooms+at, (wroom_c-at) * sizeof(wroom_t));
+    memset(wrooms+at, 0, sizeof(wroom_t));
+    wrooms[at].id = reservation->room_id;
+    wroom_c++;
+  }
+  room = wrooms+at;
+  if (room->count == room->cap) {
+    room->cap = room->cap ? room->cap * 2 : 8;
+    room->entries = realloc(room->entries, room->cap * sizeof(wentry_t));
+  }
+  // after any entries with the same start, so those keep their order
+  at = waitlist_lower(room, reservation->start + 1);
+  memmove(room->entries+at+1, room->entries+at,
+          (room->count-at) * sizeof(wentry_t));
+  seq = ++wseq;
+  room->entries[at].seq = seq;
+  room->entries[at].reservation = *reservation;
+  room->entries[at].reservation.next = NULL;
+  room->count++;
+  if (reservation->end - reservation->start > room->longest)
+    room->longest = reservation->end - reservation->start;
+  pthread_mutex_unlock(&waitlock);
+  return seq;
+}
+
+
+size_t waitlist_match(int roomid, time_t start, time_t end,
+                      wentry_t **entries)
+{
+  wroom_t *room;
+  size_t count;
+  size_t i;
+
+  *entries = NULL;
+  count = 0;
+  pthread_mutex_lock(&waitlock);
+  if ((room = waitlist_find(roomid))) {
+    waitlist_expire(room, time(NULL));
+    for (i = waitlist_lower(room, start - room->longest + 1);
+         i < room->count && room->entries[i].reservation.start < end; i++) {
+      if (room->entries[i].reservation.end <= start)
+        continue;
+      *entries = realloc(*entries, (count+1) * sizeof(wentry_t));
+      (*entries)[count++] = room->entries[i];
+    }
+  }
+  pthread_mutex_unlock(&waitlock);
+  qsort(*entries, count, sizeof(wentry_t), compar_seq);
+  return count;
+}
+
+
+/* The position of a matched entry in its room, or -1 if it is gone */
+static ssize_t waitlist_at(const wentry_t *entry, wroom_t **room)
+{
+  const reservation_t *res = &entry->reservation;
+  size_t i;
+
+  if (!(*room = waitlist_find(res->room_id)))
+    return -1;
+  for (i = waitlist_lower(*room, res->start);
+       i < (*room)->count &&
+         (*room)->entries[i].reservation.start == res->start;
+       i++)
+    if ((*room)->entries[i].seq == entry->seq)
+      return i;
+  return -1;
+}
+
+static void waitlist_remove(wroom_t *room, size_t i)
+{
+  room->count--;
+  memmove(room->entries+i, room->entries+i+1,
+          (room->count-i) * sizeof(wentry_t));
+}
+
+
+int waitlist_take(const wentry_t *entry,
+                  int (*grant)(const reservation_t *reservation, void *ctx),
+                  void *ctx)
+{
+  wroom_t *room;
+  ssize_t at;
+  int status = 1;
+
+  pthread_mutex_lock(&waitlock);
+  if (0 <= (at = waitlist_at(entry, &room)) &&
+      0 == (status = grant(&entry->reservation, ctx)))
+    waitlist_remove(room, at);
+  pthread_mutex_unlock(&waitlock);
+  return status;
+}
+
+
+int waitlist_drop(const wentry_t *entry)
+{
+  wroom_t *room;
+  ssize_t at;
+
+  pthread_mutex_lock(&waitlock);
+  if (0 <= (at = waitlist_at(entry, &room)))
+    waitlist_remove(room, at);
+  pthread_mutex_unlock(&waitlock);
+  return at < 0;
+}
+
+
+size_t waitlist_cancel(int roomid, time_t at, int user)
+{
+  wroom_t *room;
+  reservation_t *res;
+  size_t count;
+  size_t i, j;
+
+  count = 0;
+  pthread_mutex_lock(&waitlock);
+  if ((room = waitlist_find(roomid))) {
+    for (i = j = 0; i < room->count; i++) {
+      res = &room->entries[i].reservation;
+      if (res->start <= at && res->end >= at &&
+          (user < 0 || res->user_id == user))
+        count++;
+      else
+        room->entries[j++] = room->entries[i];
+    }
+    room->count = j;
+  }
+  pthread_mutex_unlock(&waitlock);
+  return count;
+}
+
+
+size_t waitlist_user(int user, wentry_t **entries)
+{
+  time_t now = time(NULL);
+  size_t count;
+  size_t i, j;
+
+  *entries = NULL;
+  count = 0;
+  pthread_mutex_lock(&waitlock);
+  for (i = 0; i < wroom_c; i++) {
+    waitlist_expire(wrooms+i, now);
+    for (j = 0; j < wrooms[i].count; j++) {
+      if (wrooms[i].entries[j].reservation.user_id != user)
+        continue;
+      *entries = realloc(*entries, (count+1) * sizeof(wentry_t));
+      (*entries)[count++] = wrooms[i].entries[j];
+    }
+  }
+  pthread_mutex_unlock(&waitlock);
+  qsort(*entries, count, sizeof(wentry_t), compar_seq);
+  return count;
+}
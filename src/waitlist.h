@@ -0,0 +1,61 @@
+#ifndef WAITLIST_H
+#define WAITLIST_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "scheduler.h"
+
+
+/* A reservation that could not be made yet, in order of arrival */
+typedef struct wentry_s {
+  uint64_t seq;
+  reservation_t reservation;
+} wentry_t;
+
+
+/**
+ * @brief Queues a reservation until its window in the room frees up
+ * @return The entry's sequence number, which orders grants
+ */
+uint64_t waitlist_add(const reservation_t *reservation);
+
+/**
+ * @brief Finds the waiting reservations in a room that overlap [start, end)
+ * Entries whose window is over are dropped first.  The matches are copied,
+ * oldest first, into a malloc'd array returned through `entries`; they
+ * stay queued until `waitlist_take` or `waitlist_drop`.
+ * @return The number of matches
+ */
+size_t waitlist_match(int roomid, time_t start, time_t end,
+                      wentry_t **entries);
+
+/**
+ * @brief Grants an entry returned by `waitlist_match` if it is still queued
+ * `grant` runs under the waitlist's lock, so the entry cannot be cancelled
+ * while it is being made, and the entry is removed if it returns 0.
+ * @return What `grant` returned, or 1 if the entry was no longer queued
+ */
+int waitlist_take(const wentry_t *entry,
+                  int (*grant)(const reservation_t *reservation, void *ctx),
+                  void *ctx);
+
+/**
+ * @brief Removes an entry returned by `waitlist_match` from its waitlist
+ * @return 0 if it was removed, non-zero if it was no longer queued
+ */
+int waitlist_drop(const wentry_t *entry);
+
+/**
+ * @brief Removes a user's entries in a room whose window includes `at`, or
+ * everyone's if `user` is negative
+ * @return The number removed
+ */
+size_t waitlist_cancel(int roomid, time_t at, int user);
+
+/**
+ * @brief Lists the reservations a user is waiting for, as `waitlist_match`
+ */
+size_t waitlist_user(int user, wentry_t **entries);
+
+#endif